@@ -0,0 +1,83 @@
+#pragma once
+#ifndef _NATIVE_ARDUINO_H_
+#define _NATIVE_ARDUINO_H_
+
+/**
+ * Minimal stand-in for the ESP8266 Arduino core used by the native build.
+ * Time is virtual: it only moves forward through delay() and sim::advance().
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <string>
+#include <functional>
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x00
+#define OUTPUT 0x01
+#define FUNCTION_0 0x08
+#define FUNCTION_3 0x0B
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+class String : public std::string {
+public:
+  using std::string::string;
+  String() = default;
+  String(const std::string &s) : std::string(s) {}
+};
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+void shiftOut(uint8_t data_pin, uint8_t clock_pin, uint8_t bit_order, uint8_t value);
+
+// GPIO output set/clear registers (esp8266_peri.h)
+extern volatile uint32_t GPOS;
+extern volatile uint32_t GPOC;
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+struct SerialClass {
+  void begin(unsigned long) {}
+  void println(const char *s) { puts(s); }
+  int printf(const char *fmt, ...);
+  operator bool() const { return true; }
+};
+extern SerialClass Serial;
+
+enum RFMode { RF_DEFAULT = 0, RF_CAL = 1, RF_NO_CAL = 2, RF_DISABLED = 4 };
+#define WAKE_RF_DEFAULT RF_DEFAULT
+#define WAKE_RF_DISABLED RF_DISABLED
+
+struct rst_info;
+
+struct EspClass {
+  bool flashRead(uint32_t address, uint32_t *data, size_t size);
+  bool flashWrite(uint32_t address, const uint32_t *data, size_t size);
+  bool flashEraseSector(uint32_t sector);
+  bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size);
+  bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size);
+  void deepSleep(uint64_t time_us, RFMode mode = RF_DEFAULT);
+  uint32_t getFreeHeap();
+  uint8_t getHeapFragmentation();
+  rst_info *getResetInfoPtr();
+};
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+#include "Arduino.h"
+
+#define U_FLASH 0
+#define U_FS 100
+
+typedef enum {
+  OTA_AUTH_ERROR,
+  OTA_BEGIN_ERROR,
+  OTA_CONNECT_ERROR,
+  OTA_RECEIVE_ERROR,
+  OTA_END_ERROR
+} ota_error_t;
+
+/**
+ * Over-the-air update service; the simulation never receives an update, so only main.cpp
+ * type-checks against it and nothing is linked
+ **/
+class ArduinoOTAClass {
+public:
+  void onStart(std::function<void()>) {}
+  void onEnd(std::function<void()>) {}
+  void onProgress(std::function<void(unsigned int, unsigned int)>) {}
+  void onError(std::function<void(ota_error_t)>) {}
+
+  void begin() {}
+  void handle() {}
+  int getCommand() { return U_FLASH; }
+};
+
+extern ArduinoOTAClass ArduinoOTA;
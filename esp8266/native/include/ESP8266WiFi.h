@@ -0,0 +1,48 @@
+#pragma once
+#include "Arduino.h"
+
+#define WL_IDLE_STATUS 0
+#define WL_CONNECTED 3
+#define WL_DISCONNECTED 6
+
+class IPAddress {
+public:
+  IPAddress() = default;
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : m_addr(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+  IPAddress(uint32_t addr) : m_addr(addr) {}
+
+  operator uint32_t() const { return m_addr; }
+  String toString() const;
+private:
+  uint32_t m_addr = 0;
+};
+
+class WiFiClient {
+public:
+  void setTimeout(unsigned long timeout) { m_timeout = timeout; }
+  unsigned long getTimeout() const { return m_timeout; }
+private:
+  unsigned long m_timeout = 1000; // Stream default
+};
+
+class WiFiClass {
+public:
+  void persistent(bool) {}
+  void setAutoConnect(bool) {}
+  void setAutoReconnect(bool) {}
+  bool config(IPAddress, IPAddress, IPAddress, IPAddress = IPAddress()) { return true; }
+  void begin(const char *, const char *, int32_t = 0, const uint8_t * = nullptr) {}
+  void reconnect() {}
+  bool disconnect() { return true; }
+  int status();
+  uint8_t *BSSID() { return m_bssid; }
+  int32_t channel() { return 6; }
+  IPAddress localIP() { return IPAddress(192, 168, 1, 106); }
+  IPAddress gatewayIP() { return IPAddress(192, 168, 1, 1); }
+  IPAddress subnetMask() { return IPAddress(255, 255, 255, 0); }
+  IPAddress dnsIP(uint8_t = 0) { return IPAddress(192, 168, 1, 1); }
+
+private:
+  uint8_t m_bssid[6] = {0x02, 0, 0, 0, 0, 0x01};
+};
+extern WiFiClass WiFi;
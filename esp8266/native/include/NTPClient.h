@@ -0,0 +1,17 @@
+#pragma once
+#include "Arduino.h"
+#include "WiFiUdp.h"
+
+/**
+ * NTP client backed by the simulation clock (see sim.h)
+ **/
+class NTPClient {
+public:
+  NTPClient(WiFiUDP &) {}
+
+  void begin() {}
+  bool update() { return true; }
+  bool forceUpdate();
+  bool isTimeSet() const;
+  time_t getEpochTime() const;
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include "Arduino.h"
+#include "ESP8266WiFi.h"
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+
+/**
+ * MQTT client talking to the simulated broker (see sim.h). Retained messages
+ * matching a subscription are delivered from loop(), like a real broker would.
+ **/
+class PubSubClient {
+  WiFiClient *m_client;
+  uint16_t m_socket_timeout = 15; // seconds, MQTT_SOCKET_TIMEOUT
+  std::string m_topic;
+  std::string m_payload;
+  bool m_retained = false;
+
+public:
+  PubSubClient(WiFiClient &client) : m_client(&client) {}
+
+  PubSubClient &setServer(const char *, uint16_t) { return *this; }
+  PubSubClient &setCallback(MQTT_CALLBACK_SIGNATURE);
+  PubSubClient &setSocketTimeout(uint16_t timeout) {
+    m_socket_timeout = timeout;
+    return *this;
+  }
+
+  bool connect(const char *id, const char *user, const char *pass);
+  bool connected();
+  int state();
+  bool subscribe(const char *topic);
+  bool publish(const char *topic, const char *payload, bool retained);
+  bool beginPublish(const char *topic, unsigned int length, bool retained);
+  size_t write(const uint8_t *data, size_t length);
+  int endPublish();
+  bool loop();
+  void flush() {}
+  void disconnect();
+};
@@ -0,0 +1,4 @@
+#pragma once
+#include "Arduino.h"
+
+class WiFiUDP {};
@@ -0,0 +1,3 @@
+#pragma once
+// some sources include the core header in lowercase, which only works on case insensitive file systems
+#include "Arduino.h"
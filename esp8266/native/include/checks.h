@@ -0,0 +1,17 @@
+#pragma once
+#ifndef _CHECKS_H_
+#define _CHECKS_H_
+
+/**
+ * Host checks of the native build. Each one prints every mismatch it finds
+ * and returns how many there were.
+ **/
+namespace checks {
+
+int cron_parser(); // the parser against the reference copy of the old, allocating one
+int cron_bit_search(); // the word-wise next/prev set bit search against the old bit-by-bit one
+int storage_records(); // what storage::read() returns after torn writes, sequence wrap-around and full rings
+
+} // namespace checks
+
+#endif
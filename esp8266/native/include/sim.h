@@ -0,0 +1,43 @@
+#pragma once
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <Arduino.h>
+
+/**
+ * Controls for the simulated hardware and network of the native build
+ **/
+namespace sim {
+
+struct Counters {
+  uint32_t flash_reads;
+  uint32_t flash_writes;
+  uint32_t flash_erases;
+  uint32_t station_starts; // 'on' station state reports
+  uint32_t mqtt_connects;
+  uint32_t mqtt_failed_connects;
+  uint32_t mqtt_published;
+  uint32_t mqtt_delivered;
+  uint32_t deep_sleeps;
+  uint64_t deep_sleep_us;
+  uint32_t cron_allocs;
+  uint64_t cron_alloc_bytes;
+};
+
+extern Counters counters;
+extern bool verbose; // print published MQTT messages
+
+void set_epoch(time_t epoch);
+void advance(unsigned long ms);
+
+void set_broker_up(bool up);
+void set_ntp_up(bool up);
+void retain(const char *topic, const char *payload);
+void publish_to_device(const char *topic, const char *payload);
+void deliver_now(const char *topic, const char *payload); // straight into the MQTT callback, no broker or loop()
+void set_reset_reason(uint32_t reason);
+void cut_power_after_flash_writes(int writes); // the writes after these fail, like a power loss; -1 restores power
+
+} // namespace sim
+
+#endif
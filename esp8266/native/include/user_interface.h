@@ -0,0 +1,10 @@
+#pragma once
+#include "Arduino.h"
+
+#define REASON_DEFAULT_RST 0
+#define REASON_DEEP_SLEEP_AWAKE 5
+#define REASON_EXT_SYS_RST 6
+
+struct rst_info {
+  uint32_t reason;
+};
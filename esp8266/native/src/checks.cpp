@@ -0,0 +1,408 @@
+/**
+ * Differential checks of the rewritten library code against reference copies
+ * of the original implementations, and checks of the flash record storage
+ * against simulated power losses.
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <Arduino.h>
+#include "checks.h"
+#include "sim.h"
+#include "storage.h"
+#include "ccronexpr/ccronexpr.h"
+
+extern "C" {
+void cron_ref_parse_expr(const char *expression, cron_expr *target, const char **error);
+unsigned int cron_ref_next_set_bit(uint8_t *bits, unsigned int max, unsigned int from_index, int *notfound);
+unsigned int cron_ref_prev_set_bit(uint8_t *bits, int from_index, int to_index, int *notfound);
+unsigned int cron_test_next_set_bit(uint8_t *bits, unsigned int max, unsigned int from_index, int *notfound);
+unsigned int cron_test_prev_set_bit(uint8_t *bits, int from_index, int to_index, int *notfound);
+}
+
+namespace checks {
+
+static const char *PARSER_CORPUS[] = {
+  // valid
+  "0 0 6 * * *",
+  "0 30 6 1-31/2 * *",
+  "0 20 6 * * MON,WED,FRI",
+  "0 0 21 */2 * *",
+  "*/20 * * * * *",
+  "0 0/15 5-8 * JUN-AUG *",
+  "15,45 10 4 1,15 * ?",
+  "* * * * * *",
+  "0 0 0 ? * MON-FRI",
+  "0 0 12 * JAN-MAR,DEC SUN",
+  "*/5 */10 1-5/2 1,15 * 0-6",
+  "0 0 0 1 1 7",
+  "  0   0  0 1 1 1  ",
+  "0\t0 0 * * *",
+  "0 0 0 1-31/2 * *\n",
+  "0 0 0 * * SAT,SUN",
+  "0 0 0 ? ? ?",
+  "0 0 0 * * ?",
+  "3/5 * * * * *",
+  "10-20/3 * * * * *",
+  "0 0 0 * jan,feb mon",
+  "0 0 0 * * 7-7",
+  "010 * * * * *",
+  "59 59 23 31 DEC SAT",
+  "0-59 0-59 0-23 1-31 1-12 0-7",
+  "31,32,33 31,32 0 31 * *",
+  "0 0 0 1 * *",
+  "0 0 0 * 1-12/3 *",
+  // invalid
+  "",
+  "0 0",
+  "0 0 0 * * * *",
+  "60 0 0 * * *",
+  "0 60 0 * * *",
+  "0 0 24 * * *",
+  "0 0 0 0 * *",
+  "0 0 0 32 * *",
+  "0 0 0 * 13 *",
+  "0 0 0 * 0 *",
+  "0 0 0 * * 8",
+  "5-3 * * * * *",
+  "*/0 * * * * *",
+  "1/2/3 * * * * *",
+  "1-2-3 * * * * *",
+  "a * * * * *",
+  "- * * * * *",
+  "1- * * * * *",
+  "-1 * * * * *",
+  "0x10 * * * * *",
+  "1,2,,3 * * * * *",
+  ", * * * * *",
+  "/ * * * * *",
+  "*/ * * * * *",
+  "0 0 0 * FOO *",
+  "0 0 0 * DEC-JAN *",
+  "0 0 0 * OCTNOV *",
+  "0 0 0 * * SUNMON",
+  "0 0 0 L * *",
+  "0 0 0 * * MON-",
+  "99999999999999999999 * * * * *",
+  "0 0 6 * * *|900",
+  "\t\n",
+  NULL,
+};
+
+static const struct {
+  const char *name;
+  size_t offset;
+  size_t size;
+} CRON_FIELDS[] = {
+  {"seconds", offsetof(cron_expr, seconds), sizeof(cron_expr::seconds)},
+  {"minutes", offsetof(cron_expr, minutes), sizeof(cron_expr::minutes)},
+  {"hours", offsetof(cron_expr, hours), sizeof(cron_expr::hours)},
+  {"days_of_week", offsetof(cron_expr, days_of_week), sizeof(cron_expr::days_of_week)},
+  {"days_of_month", offsetof(cron_expr, days_of_month), sizeof(cron_expr::days_of_month)},
+  {"months", offsetof(cron_expr, months), sizeof(cron_expr::months)},
+};
+
+static void print_bytes(const uint8_t *bytes, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    printf("%02x", bytes[i]);
+  }
+}
+
+static int check_parse(const char *expression) {
+  // the targets start out with the same garbage, so fields left unwritten on errors are compared as well
+  cron_expr expected, actual;
+  memset(&expected, 0xAA, sizeof(expected));
+  memset(&actual, 0xAA, sizeof(actual));
+  const char *expected_err = NULL;
+  const char *actual_err = NULL;
+  cron_ref_parse_expr(expression, &expected, &expected_err);
+  cron_parse_expr(expression, &actual, &actual_err);
+
+  int mismatches = 0;
+  if ((expected_err == NULL) != (actual_err == NULL) ||
+      (expected_err != NULL && strcmp(expected_err, actual_err) != 0)) {
+    printf("MISMATCH cron_parse_expr(\"%s\"): error \"%s\", expected \"%s\"\n", expression ? expression : "(null)",
+           actual_err ? actual_err : "(null)", expected_err ? expected_err : "(null)");
+    mismatches++;
+  }
+  for (const auto &field : CRON_FIELDS) {
+    const uint8_t *e = (const uint8_t *)&expected + field.offset;
+    const uint8_t *a = (const uint8_t *)&actual + field.offset;
+    if (memcmp(e, a, field.size) != 0) {
+      printf("MISMATCH cron_parse_expr(\"%s\"): %s ", expression ? expression : "(null)", field.name);
+      print_bytes(a, field.size);
+      printf(", expected ");
+      print_bytes(e, field.size);
+      printf("\n");
+      mismatches++;
+    }
+  }
+  return mismatches;
+}
+
+int cron_parser() {
+  int mismatches = 0;
+  int count = 0;
+  for (const char *expression : PARSER_CORPUS) {
+    mismatches += check_parse(expression);
+    count++;
+  }
+
+  // padded to right below and above the 256 byte split limit of the old parser
+  for (size_t len : {254, 255, 256, 257, 400}) {
+    std::string expression(len - 11, ' ');
+    expression += "0 0 0 * * *";
+    mismatches += check_parse(expression.c_str());
+    count++;
+  }
+
+  printf("Check cron_parse_expr: %d expressions, %d mismatches\n", count, mismatches);
+  return mismatches;
+}
+
+// the cron field lengths (seconds/minutes, hours, days of week, days of month, months)
+// and the lengths around the byte and 32 bit word boundaries
+static const unsigned int BITSET_LENGTHS[] = {1, 7, 8, 9, 12, 24, 31, 32, 33, 60, 63, 64};
+static const unsigned int EXHAUSTIVE_MAX_LENGTH = 12; // every bit pattern up to this length
+static const int RANDOM_PATTERNS = 512;
+
+static uint32_t s_rand_state = 0x12345678;
+
+static uint32_t next_rand() {
+  s_rand_state ^= s_rand_state << 13;
+  s_rand_state ^= s_rand_state >> 17;
+  s_rand_state ^= s_rand_state << 5;
+  return s_rand_state;
+}
+
+static void print_bits(const uint8_t *bits, unsigned int length) {
+  for (unsigned int i = 0; i < length; i++) {
+    putchar(bits[i / 8] & (1 << (i % 8)) ? '1' : '0');
+  }
+}
+
+static int check_next_set_bit(uint8_t *bits, unsigned int length, unsigned int from) {
+  int expected_notfound = 0;
+  int actual_notfound = 0;
+  unsigned int expected = cron_ref_next_set_bit(bits, length, from, &expected_notfound);
+  unsigned int actual = cron_test_next_set_bit(bits, length, from, &actual_notfound);
+  if (expected_notfound != actual_notfound || (!expected_notfound && expected != actual)) {
+    printf("MISMATCH next_set_bit(");
+    print_bits(bits, length);
+    printf(", %u, %u): %u%s, expected %u%s\n", length, from, actual, actual_notfound ? " not found" : "", expected,
+           expected_notfound ? " not found" : "");
+    return 1;
+  }
+  return 0;
+}
+
+static int check_prev_set_bit(uint8_t *bits, unsigned int length, int from, int to) {
+  int expected_notfound = 0;
+  int actual_notfound = 0;
+  unsigned int expected = cron_ref_prev_set_bit(bits, from, to, &expected_notfound);
+  unsigned int actual = cron_test_prev_set_bit(bits, from, to, &actual_notfound);
+  if (expected_notfound != actual_notfound || (!expected_notfound && expected != actual)) {
+    printf("MISMATCH prev_set_bit(");
+    print_bits(bits, length);
+    printf(", %d, %d): %u%s, expected %u%s\n", from, to, actual, actual_notfound ? " not found" : "", expected,
+           expected_notfound ? " not found" : "");
+    return 1;
+  }
+  return 0;
+}
+
+// every from offset of next_set_bit(), including the one past the end, and every to <= from of
+// prev_set_bit() plus a to above from; 'full' limits prev_set_bit() to three 'to' offsets per 'from'
+static int check_bit_offsets(uint8_t *bits, unsigned int length, bool full, uint32_t &searches) {
+  int mismatches = 0;
+  for (unsigned int from = 0; from <= length; from++) {
+    mismatches += check_next_set_bit(bits, length, from);
+    searches++;
+  }
+  for (int from = -1; from < (int)length; from++) {
+    for (int to = 0; to <= from + 1; to++) {
+      if (!full && to != 0 && to != from / 2 && to != from) {
+        continue;
+      }
+      mismatches += check_prev_set_bit(bits, length, from, to);
+      searches++;
+    }
+  }
+  return mismatches;
+}
+
+static void set_pattern(uint8_t *bits, unsigned int length, uint64_t pattern) {
+  for (unsigned int i = 0; i < (length + 7) / 8; i++) {
+    bits[i] = (uint8_t)(pattern >> (8 * i));
+  }
+}
+
+int cron_bit_search() {
+  int mismatches = 0;
+  uint32_t patterns = 0;
+  uint32_t searches = 0;
+  for (unsigned int length : BITSET_LENGTHS) {
+    // exactly the bytes of the field, so that reading past it trips the sanitizers
+    unsigned int size = (length + 7) / 8;
+    uint8_t *bits = (uint8_t *)malloc(size);
+    uint64_t mask = length == 64 ? ~0ULL : (1ULL << length) - 1;
+
+    if (length <= EXHAUSTIVE_MAX_LENGTH) {
+      for (uint64_t pattern = 0; pattern <= mask; pattern++) {
+        set_pattern(bits, length, pattern);
+        mismatches += check_bit_offsets(bits, length, true, searches);
+        patterns++;
+      }
+    } else {
+      set_pattern(bits, length, 0);
+      mismatches += check_bit_offsets(bits, length, true, searches);
+      set_pattern(bits, length, mask);
+      mismatches += check_bit_offsets(bits, length, true, searches);
+      patterns += 2;
+      for (unsigned int i = 0; i < length; i++) {
+        set_pattern(bits, length, 1ULL << i);
+        mismatches += check_bit_offsets(bits, length, true, searches);
+        set_pattern(bits, length, mask & ~(1ULL << i));
+        mismatches += check_bit_offsets(bits, length, true, searches);
+        patterns += 2;
+        for (unsigned int j = i + 1; j < length; j++) {
+          set_pattern(bits, length, (1ULL << i) | (1ULL << j));
+          mismatches += check_bit_offsets(bits, length, false, searches);
+          patterns++;
+        }
+      }
+      for (int i = 0; i < RANDOM_PATTERNS; i++) {
+        uint64_t pattern = ((uint64_t)next_rand() << 32) | next_rand();
+        // sparse, even and dense patterns
+        if (i % 3 == 0) {
+          pattern &= ((uint64_t)next_rand() << 32) | next_rand();
+        } else if (i % 3 == 2) {
+          pattern |= ((uint64_t)next_rand() << 32) | next_rand();
+        }
+        set_pattern(bits, length, pattern & mask);
+        mismatches += check_bit_offsets(bits, length, true, searches);
+        patterns++;
+      }
+    }
+    free(bits);
+  }
+
+  printf("Check next/prev_set_bit: %u patterns, %u searches, %d mismatches\n", patterns, searches, mismatches);
+  return mismatches;
+}
+
+// The native build puts the storage sectors at the start of the flash. Records start with
+// their header: magic (2 bytes), payload size (2 bytes) and sequence number (4 bytes).
+static const uint32_t STORAGE_SIZE = STORAGE_SECTORS * SPI_FLASH_SEC_SIZE;
+static const uint32_t RECORD_SEQ_OFFSET = 4;
+static const size_t STORAGE_RECORD_SIZE = 40;
+static const int STORAGE_RECORDS = 60; // more than both sectors hold
+
+static void make_record(uint8_t *record, int n) {
+  for (size_t i = 0; i < STORAGE_RECORD_SIZE; i++) {
+    record[i] = (uint8_t)(n * 31 + i);
+  }
+}
+
+// what a reboot sees: the records are scanned from the flash again
+static int check_read_back(const char *what, int n, int expected) {
+  namespace storage = sprinkler_controller::storage;
+
+  uint8_t data[STORAGE_MAX_RECORD];
+  uint8_t record[STORAGE_RECORD_SIZE];
+  make_record(record, expected);
+
+  size_t length = storage::begin() ? storage::read(data, sizeof(data)) : 0;
+  if (length != STORAGE_RECORD_SIZE || memcmp(data, record, STORAGE_RECORD_SIZE) != 0) {
+    printf("MISMATCH storage::read() after %s %d: %u bytes", what, n, (unsigned)length);
+    for (int i = 0; i <= n; i++) {
+      make_record(record, i);
+      if (length == STORAGE_RECORD_SIZE && memcmp(data, record, STORAGE_RECORD_SIZE) == 0) {
+        printf(" of record %d", i);
+      }
+    }
+    printf(", expected record %d\n", expected);
+    return 1;
+  }
+  return 0;
+}
+
+static void erase_storage() {
+  for (uint32_t sector = 0; sector < STORAGE_SECTORS; sector++) {
+    ESP.flashEraseSector(sector);
+  }
+}
+
+int storage_records() {
+  namespace storage = sprinkler_controller::storage;
+
+  // the simulation runs on the same flash afterwards
+  static uint32_t saved[STORAGE_SIZE / 4];
+  ESP.flashRead(0, saved, STORAGE_SIZE);
+
+  int mismatches = 0;
+  int reads = 0;
+  uint8_t record[STORAGE_RECORD_SIZE];
+
+  // every slot in turn, through both sectors and around again
+  erase_storage();
+  storage::begin();
+  for (int n = 0; n < STORAGE_RECORDS; n++) {
+    make_record(record, n);
+    storage::write(record, sizeof(record));
+    mismatches += check_read_back("write", n, n);
+    reads++;
+  }
+
+  // power lost after the payload and before the header of every slot in turn: the previous record
+  // stays current, and the next write goes around the torn slot
+  erase_storage();
+  storage::begin();
+  for (int n = 0; n < STORAGE_RECORDS; n += 2) {
+    make_record(record, n);
+    storage::write(record, sizeof(record));
+
+    make_record(record, n + 1);
+    sim::cut_power_after_flash_writes(1);
+    storage::write(record, sizeof(record));
+    sim::cut_power_after_flash_writes(-1);
+    mismatches += check_read_back("torn write", n + 1, n);
+    reads++;
+  }
+  make_record(record, STORAGE_RECORDS);
+  storage::write(record, sizeof(record));
+  mismatches += check_read_back("write after torn writes", STORAGE_RECORDS, STORAGE_RECORDS);
+  reads++;
+
+  // a first record with a sequence number right below the wrap-around, rewritten in place
+  erase_storage();
+  storage::begin();
+  make_record(record, 0);
+  storage::write(record, sizeof(record));
+  uint32_t first[(8 + STORAGE_RECORD_SIZE) / 4];
+  ESP.flashRead(0, first, sizeof(first));
+  uint32_t seq = 0xFFFFFFFF - 3;
+  memcpy((uint8_t *)first + RECORD_SEQ_OFFSET, &seq, sizeof(seq));
+  erase_storage();
+  ESP.flashWrite(0, first, sizeof(first));
+  mismatches += check_read_back("sequence number", seq, 0);
+  reads++;
+  for (int n = 1; n < STORAGE_RECORDS; n++) {
+    make_record(record, n);
+    storage::write(record, sizeof(record));
+    mismatches += check_read_back("wrapped write", n, n);
+    reads++;
+  }
+
+  erase_storage();
+  ESP.flashWrite(0, saved, STORAGE_SIZE);
+  storage::begin();
+
+  printf("Check storage::read(): %d reads after writes, torn writes and sequence wrap-around, %d mismatches\n", reads,
+         mismatches);
+  return mismatches;
+}
+
+} // namespace checks
@@ -0,0 +1,376 @@
+/**
+ * Native implementation of the Arduino core, NTP, WiFi and MQTT stand-ins.
+ */
+#include <Arduino.h>
+#include <NTPClient.h>
+#include <ESP8266WiFi.h>
+#include <PubSubClient.h>
+#include <user_interface.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "sim.h"
+
+#define FLASH_SECTORS 16
+#define RTC_USER_MEMORY_SIZE 512
+
+SerialClass Serial;
+EspClass ESP;
+WiFiClass WiFi;
+
+namespace sim {
+
+Counters counters = {};
+bool verbose = false;
+
+static uint64_t s_millis = 0;
+static uint64_t s_boot_millis = 0; // like on the chip, millis() and micros() restart after deep sleep
+static time_t s_epoch_base = 0; // epoch time at millis() == 0
+static bool s_ntp_up = true;
+static bool s_ntp_synced = false;
+static bool s_broker_up = true;
+static bool s_connected = false;
+static rst_info s_reset_info = {REASON_DEFAULT_RST};
+
+static uint8_t s_flash[FLASH_SECTORS * SPI_FLASH_SEC_SIZE];
+static int s_flash_writes_left = -1; // until the power is cut, -1 for never
+static uint8_t s_rtc_memory[RTC_USER_MEMORY_SIZE];
+
+static std::function<void(char*, uint8_t*, unsigned int)> s_callback;
+static std::map<std::string, std::string> s_retained;
+static std::vector<std::string> s_subscriptions;
+static std::vector<std::pair<std::string, std::string>> s_inbox;
+
+static bool topic_matches(const std::string &filter, const std::string &topic) {
+  size_t f = 0, t = 0;
+
+  while (f < filter.size()) {
+    if (filter[f] == '#') {
+      return true;
+    }
+    if (filter[f] == '+') {
+      while (t < topic.size() && topic[t] != '/') t++;
+      f++;
+      continue;
+    }
+    if (t >= topic.size() || filter[f] != topic[t]) {
+      return false;
+    }
+    f++;
+    t++;
+  }
+
+  return t == topic.size();
+}
+
+static bool subscribed(const std::string &topic) {
+  for (const std::string &filter : s_subscriptions) {
+    if (topic_matches(filter, topic)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void set_epoch(time_t epoch) {
+  s_epoch_base = epoch - (time_t)(s_millis / 1000);
+}
+
+void advance(unsigned long ms) {
+  s_millis += ms;
+}
+
+void set_broker_up(bool up) {
+  s_broker_up = up;
+  if (!up) {
+    s_connected = false;
+  }
+}
+
+void set_ntp_up(bool up) {
+  s_ntp_up = up;
+}
+
+void retain(const char *topic, const char *payload) {
+  s_retained[topic] = payload;
+}
+
+void publish_to_device(const char *topic, const char *payload) {
+  if (s_connected && subscribed(topic)) {
+    s_inbox.emplace_back(topic, payload);
+  }
+}
+
+// Like PubSubClient, the topic is terminated in place and the payload follows it in
+// the same buffer without a terminator; the filler after it catches overreads.
+static void deliver(const std::string &topic, const std::string &payload) {
+  static std::vector<char> buffer;
+  buffer.assign(topic.begin(), topic.end());
+  buffer.push_back('\0');
+  buffer.insert(buffer.end(), payload.begin(), payload.end());
+  buffer.insert(buffer.end(), 16, '#');
+  counters.mqtt_delivered++;
+  s_callback(buffer.data(), (uint8_t *)buffer.data() + topic.size() + 1, payload.size());
+}
+
+void deliver_now(const char *topic, const char *payload) {
+  deliver(topic, payload);
+}
+
+void set_reset_reason(uint32_t reason) {
+  s_reset_info.reason = reason;
+}
+
+void cut_power_after_flash_writes(int writes) {
+  s_flash_writes_left = writes;
+}
+
+} // namespace sim
+
+using namespace sim;
+
+unsigned long millis() {
+  return (unsigned long)(s_millis - s_boot_millis);
+}
+
+unsigned long micros() {
+  return (unsigned long)((s_millis - s_boot_millis) * 1000);
+}
+
+void delay(unsigned long ms) {
+  s_millis += ms;
+}
+
+void yield() {}
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+void shiftOut(uint8_t, uint8_t, uint8_t, uint8_t) {}
+
+volatile uint32_t GPOS;
+volatile uint32_t GPOC;
+
+long random(long max) {
+  return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max) {
+  return min + random(max - min);
+}
+
+void randomSeed(unsigned long seed) {
+  srand(seed);
+}
+
+int SerialClass::printf(const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  int n = vprintf(fmt, args);
+  va_end(args);
+  return n;
+}
+
+bool EspClass::flashRead(uint32_t address, uint32_t *data, size_t size) {
+  if (address % 4 != 0 || address + size > sizeof(s_flash)) {
+    return false;
+  }
+  memcpy(data, s_flash + address, size);
+  counters.flash_reads++;
+  return true;
+}
+
+bool EspClass::flashWrite(uint32_t address, const uint32_t *data, size_t size) {
+  if (address % 4 != 0 || size % 4 != 0 || address + size > sizeof(s_flash) || s_flash_writes_left == 0) {
+    return false;
+  }
+  if (s_flash_writes_left > 0) {
+    s_flash_writes_left--;
+  }
+  // NOR flash can only clear bits, setting them requires an erase
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < size; i++) {
+    s_flash[address + i] &= bytes[i];
+  }
+  counters.flash_writes++;
+  return true;
+}
+
+bool EspClass::flashEraseSector(uint32_t sector) {
+  if (sector >= FLASH_SECTORS) {
+    return false;
+  }
+  memset(s_flash + sector * SPI_FLASH_SEC_SIZE, 0xFF, SPI_FLASH_SEC_SIZE);
+  counters.flash_erases++;
+  return true;
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size) {
+  if (offset * 4 + size > RTC_USER_MEMORY_SIZE) {
+    return false;
+  }
+  memcpy(data, s_rtc_memory + offset * 4, size);
+  return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size) {
+  if (offset * 4 + size > RTC_USER_MEMORY_SIZE) {
+    return false;
+  }
+  memcpy(s_rtc_memory + offset * 4, data, size);
+  return true;
+}
+
+void EspClass::deepSleep(uint64_t time_us, RFMode) {
+  counters.deep_sleeps++;
+  counters.deep_sleep_us += time_us;
+  s_millis += time_us / 1000;
+  s_boot_millis = s_millis;
+  s_reset_info.reason = REASON_DEEP_SLEEP_AWAKE;
+}
+
+uint32_t EspClass::getFreeHeap() {
+  return 40 * 1024;
+}
+
+uint8_t EspClass::getHeapFragmentation() {
+  return 0;
+}
+
+rst_info *EspClass::getResetInfoPtr() {
+  return &s_reset_info;
+}
+
+bool NTPClient::forceUpdate() {
+  if (s_ntp_up) {
+    s_ntp_synced = true;
+  }
+  return s_ntp_up;
+}
+
+bool NTPClient::isTimeSet() const {
+  return s_ntp_synced;
+}
+
+time_t NTPClient::getEpochTime() const {
+  // like the real client, the time counts from boot until the first sync
+  return (s_ntp_synced ? s_epoch_base : 0) + (time_t)(s_millis / 1000);
+}
+
+String IPAddress::toString() const {
+  char buf[16];
+  sprintf(buf, "%u.%u.%u.%u", m_addr & 0xFF, (m_addr >> 8) & 0xFF, (m_addr >> 16) & 0xFF, m_addr >> 24);
+  return String(buf);
+}
+
+int WiFiClass::status() {
+  return WL_CONNECTED;
+}
+
+PubSubClient &PubSubClient::setCallback(MQTT_CALLBACK_SIGNATURE) {
+  s_callback = callback;
+  return *this;
+}
+
+bool PubSubClient::connect(const char *, const char *, const char *) {
+  if (!s_broker_up) {
+    // the worst case on the chip: the TCP connect times out just short of the client timeout,
+    // then the CONNACK wait runs into the socket timeout
+    advance(m_client->getTimeout() + m_socket_timeout * 1000UL);
+    counters.mqtt_failed_connects++;
+    return false;
+  }
+  counters.mqtt_connects++;
+  s_connected = true;
+  s_subscriptions.clear();
+  s_inbox.clear();
+  return true;
+}
+
+bool PubSubClient::connected() {
+  return s_connected;
+}
+
+int PubSubClient::state() {
+  return s_connected ? 0 : -2;
+}
+
+bool PubSubClient::subscribe(const char *topic) {
+  if (!s_connected) {
+    return false;
+  }
+  s_subscriptions.push_back(topic);
+  for (auto &retained : s_retained) {
+    if (topic_matches(topic, retained.first)) {
+      s_inbox.emplace_back(retained.first, retained.second);
+    }
+  }
+  return true;
+}
+
+bool PubSubClient::publish(const char *topic, const char *payload, bool retained) {
+  if (!s_connected) {
+    return false;
+  }
+  if (retained) {
+    s_retained[topic] = payload;
+  }
+  counters.mqtt_published++;
+  if (strncmp(topic, "lawn-irrigation/station", 23) == 0 && strcmp(payload, "on") == 0) {
+    counters.station_starts++;
+  }
+  if (verbose) {
+    printf("  mqtt> %s: %s\n", topic, payload);
+  }
+  return true;
+}
+
+bool PubSubClient::beginPublish(const char *topic, unsigned int length, bool retained) {
+  if (!s_connected) {
+    return false;
+  }
+  m_topic = topic;
+  m_payload.clear();
+  m_payload.reserve(length);
+  m_retained = retained;
+  return true;
+}
+
+size_t PubSubClient::write(const uint8_t *data, size_t length) {
+  m_payload.append((const char *)data, length);
+  return length;
+}
+
+int PubSubClient::endPublish() {
+  return publish(m_topic.c_str(), m_payload.c_str(), m_retained);
+}
+
+bool PubSubClient::loop() {
+  if (!s_connected) {
+    return false;
+  }
+
+  // deliver what has arrived so far; handlers may publish while we iterate
+  std::vector<std::pair<std::string, std::string>> inbox;
+  inbox.swap(s_inbox);
+  for (auto &message : inbox) {
+    deliver(message.first, message.second);
+  }
+
+  return true;
+}
+
+void PubSubClient::disconnect() {
+  s_connected = false;
+}
+
+#ifdef CRON_TEST_MALLOC
+extern "C" void *cron_malloc(size_t n) {
+  counters.cron_allocs++;
+  counters.cron_alloc_bytes += n;
+  return malloc(n);
+}
+
+extern "C" void cron_free(void *p) {
+  free(p);
+}
+#endif
@@ -0,0 +1,332 @@
+/**
+ * Native simulation and benchmarks of the sprinkler controller.
+ *
+ * Checks the rewritten library code against reference copies and the flash
+ * storage against power losses (see checks.h). Then runs a whole irrigation
+ * season of deep sleep wakes against a virtual clock, an interface mode
+ * session with a broker outage, and times the hot paths on the host CPU.
+ * Exits non-zero if a check fails. Build and run with:
+ *
+ *   pio run -e native && .pio/build/native/program
+ */
+#include <chrono>
+#include <string>
+#include <user_interface.h>
+#include "sim.h"
+#include "checks.h"
+#include "stations.h"
+#include "storage.h"
+#include "valves.h"
+#include "mqttcli.h"
+#include "topics.h"
+#include "eventlog.h"
+#include "telemetry.h"
+#include "ccronexpr/ccronexpr.h"
+
+extern "C" {
+void cron_ref_parse_expr(const char *expression, cron_expr *target, const char **error);
+time_t cron_ref_next(cron_expr *expr, time_t date);
+}
+
+using namespace sprinkler_controller;
+
+static const time_t SEASON_START = 1680307200; // 2023-04-01 00:00:00 UTC
+static const int SEASON_DAYS = 180;
+static const int DEEP_SLEEP_THRESHOLD = 3 * 60 * 60;
+
+static const char *CRON_CORPUS[] = {
+  "0 0 6 * * *",
+  "0 30 6 1-31/2 * *",
+  "0 20 6 * * MON,WED,FRI",
+  "0 0 21 */2 * *",
+  "*/20 * * * * *",
+  "0 0/15 5-8 * JUN-AUG *",
+  "15,45 10 4 1,15 * ?",
+};
+
+static WiFiUDP udp;
+static NTPClient time_client(udp);
+
+template <typename F>
+static double ns_per_op(int iterations, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    f(i);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+static void configure_broker() {
+  sim::retain("lawn-irrigation/station1/config", "0 0 6 * * *|900");
+  sim::retain("lawn-irrigation/station2/config", "0 20 6 * * MON,WED,FRI|600");
+  sim::retain("lawn-irrigation/station3/config", "0 0 21 */2 * *|1200|1500");
+  sim::retain("lawn-irrigation/interface-mode/set", "off");
+  sim::retain("lawn-irrigation/enabled/set", "on");
+}
+
+static void print_valve_stats(const valves::Stats &before) {
+  const valves::Stats &st = valves::stats();
+  printf("  valve pulses:          %u for %u transitions (%.1f s)\n", st.pulses - before.pulses,
+         st.requests - before.requests, (st.pulse_ms - before.pulse_ms) / 1000.0);
+}
+
+// Mirrors the deep sleep cycle of main.cpp: wake, process the due event and sleep until the next one
+static void run_season() {
+  sim::Counters before = sim::counters;
+  storage::Stats storage_before = storage::stats();
+  valves::Stats valves_before = valves::stats();
+  time_t end = SEASON_START + SEASON_DAYS * 24 * 60 * 60;
+  uint32_t wakes = 0;
+  double wake_ns = 0;
+
+  while (time_client.getEpochTime() < end) {
+    StationController *ctr = new StationController(); // a wake starts from a clean RAM
+
+    auto start = std::chrono::steady_clock::now();
+    telemetry::begin();
+    ctr->init(&time_client);
+    ctr->process_station_event();
+    telemetry::mark(telemetry::EVENTS);
+    StationEvent ev = ctr->next_station_event();
+    wake_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    valves::wait_idle();
+
+    time_t now = time_client.getEpochTime();
+    time_t sleep_duration = DEEP_SLEEP_THRESHOLD;
+    if (ev.type != EventType::NOOP && ev.time > now && ev.time - now <= DEEP_SLEEP_THRESHOLD) {
+      sleep_duration = ev.time - now;
+    }
+
+    eventlog::add(eventlog::DEEP_SLEEP, now, 0, 0, sleep_duration);
+    eventlog::flush();
+    telemetry::flush();
+    mqttcli::disconnect();
+    telemetry::mark(telemetry::SLEEP);
+    telemetry::save(now);
+
+    delete ctr;
+    wakes++;
+    ESP.deepSleep((uint64_t)sleep_duration * 1000000ULL);
+  }
+
+  const storage::Stats &st = storage::stats();
+  printf("Season: %d days, %u wakes, %u station starts\n", SEASON_DAYS, wakes, sim::counters.station_starts - before.station_starts);
+  printf("  CPU per wake (host):   %10.0f ns\n", wake_ns / wakes);
+  printf("  flash writes/erases:   %u / %u (%.2f erases per day)\n", sim::counters.flash_writes - before.flash_writes,
+         sim::counters.flash_erases - before.flash_erases, (double)(sim::counters.flash_erases - before.flash_erases) / SEASON_DAYS);
+  printf("  storage records:       %u written, %u skipped\n", st.writes - storage_before.writes, st.skipped - storage_before.skipped);
+  print_valve_stats(valves_before);
+  printf("  MQTT:                  %u published, %u delivered\n", sim::counters.mqtt_published - before.mqtt_published,
+         sim::counters.mqtt_delivered - before.mqtt_delivered);
+}
+
+// Interface mode for a few hours, with a broker outage in the middle
+static void run_interface_session() {
+  const unsigned long STEP_MS = 50;
+  const unsigned long SESSION_MS = 6UL * 60 * 60 * 1000;
+  sim::Counters before = sim::counters;
+
+  valves::Stats valves_before = valves::stats();
+
+  sim::set_reset_reason(REASON_EXT_SYS_RST);
+  sim::retain("lawn-irrigation/interface-mode/set", "on");
+  sim::retain("lawn-irrigation/station4/config", "0 */30 * * * *|300");
+
+  StationController ctr;
+  ctr.init(&time_client);
+
+  unsigned long max_iteration_ms = 0;
+  unsigned long max_quiet_iteration_ms = 0; // without a connection attempt
+  for (unsigned long t = 0; t < SESSION_MS; t += STEP_MS) {
+    if (t == SESSION_MS / 3) {
+      sim::set_broker_up(false);
+    } else if (t == SESSION_MS / 3 + 20 * 60 * 1000) {
+      sim::set_broker_up(true);
+    }
+
+    unsigned long start = millis();
+    uint32_t attempts = sim::counters.mqtt_connects + sim::counters.mqtt_failed_connects;
+    ctr.loop();
+    unsigned long iteration_ms = millis() - start;
+    if (iteration_ms > max_iteration_ms) {
+      max_iteration_ms = iteration_ms;
+    }
+    if (attempts == sim::counters.mqtt_connects + sim::counters.mqtt_failed_connects && iteration_ms > max_quiet_iteration_ms) {
+      max_quiet_iteration_ms = iteration_ms;
+    }
+
+    sim::advance(STEP_MS);
+  }
+
+  printf("Interface session: %lu h, 20 min broker outage\n", SESSION_MS / 3600000);
+  printf("  station starts:        %u\n", sim::counters.station_starts - before.station_starts);
+  printf("  longest loop():        %lu ms (virtual), %lu ms without an MQTT connect attempt\n", max_iteration_ms,
+         max_quiet_iteration_ms);
+  printf("  MQTT connects:         %u ok, %u failed\n", sim::counters.mqtt_connects - before.mqtt_connects,
+         sim::counters.mqtt_failed_connects - before.mqtt_failed_connects);
+  printf("  flash writes/erases:   %u / %u\n", sim::counters.flash_writes - before.flash_writes, sim::counters.flash_erases - before.flash_erases);
+  print_valve_stats(valves_before);
+
+  sim::retain("lawn-irrigation/interface-mode/set", "off");
+}
+
+// The topic routing that topics::match() replaced, kept as the benchmark baseline
+static int legacy_route(const char *topic) {
+  auto starts_with = [](const char *start_str, const char *str) {
+    return strncmp(start_str, str, strlen(start_str)) == 0;
+  };
+  auto index_of = [](const char *str, const char *findstr) {
+    const char *pos = strstr(str, findstr);
+    return pos ? (int)(pos - str) : -1;
+  };
+
+  if (starts_with("lawn-irrigation/interface-mode/set", topic)) {
+    return 1;
+  } else if (starts_with("lawn-irrigation/enabled/set", topic)) {
+    return 2;
+  } else if (starts_with("lawn-irrigation/station", topic)) {
+    const char *found = strstr(topic, "/station");
+    int id = found ? found[8] - '0' : 0;
+    if (id > 0 && id <= NUM_STATIONS) {
+      if (index_of(topic, "set") > 0) {
+        return 3 + id;
+      } else if (index_of(topic, "state") > 0) {
+        return 3 + id;
+      } else if (index_of(topic, "config") > 0) {
+        return 3 + id;
+      }
+    }
+  }
+  return 0;
+}
+
+static void run_benchmarks() {
+  const int N = 20000;
+  const int corpus_size = sizeof(CRON_CORPUS) / sizeof(CRON_CORPUS[0]);
+  cron_expr exprs[corpus_size];
+
+  sim::Counters before = sim::counters;
+  double parse_ns = ns_per_op(N, [&](int i) {
+    const char *err = NULL;
+    cron_parse_expr(CRON_CORPUS[i % corpus_size], &exprs[i % corpus_size], &err);
+  });
+  uint32_t allocs = sim::counters.cron_allocs - before.cron_allocs;
+  uint64_t alloc_bytes = sim::counters.cron_alloc_bytes - before.cron_alloc_bytes;
+
+  double next_ns = ns_per_op(N, [&](int i) {
+    cron_next(&exprs[i % corpus_size], SEASON_START + i * 37);
+  });
+
+  // bits far apart in every field versus every bit set, upstream cron_next() (before) versus ours (after)
+  cron_expr sparse, dense;
+  cron_parse_expr("59 59 23 28 DEC *", &sparse, NULL);
+  cron_parse_expr("* * * * * *", &dense, NULL);
+  cron_expr ref_sparse, ref_dense;
+  cron_ref_parse_expr("59 59 23 28 DEC *", &ref_sparse, NULL);
+  cron_ref_parse_expr("* * * * * *", &ref_dense, NULL);
+  double ref_sparse_ns = ns_per_op(N, [&](int i) {
+    cron_ref_next(&ref_sparse, SEASON_START + i * 37);
+  });
+  double ref_dense_ns = ns_per_op(N, [&](int i) {
+    cron_ref_next(&ref_dense, SEASON_START + i * 37);
+  });
+  double sparse_ns = ns_per_op(N, [&](int i) {
+    cron_next(&sparse, SEASON_START + i * 37);
+  });
+  double dense_ns = ns_per_op(N, [&](int i) {
+    cron_next(&dense, SEASON_START + i * 37);
+  });
+
+  // the next 16 fire times of every corpus expression, chained cron_next() versus one cron_next_n()
+  const int AGENDA_N = 16;
+  time_t agenda[AGENDA_N];
+  double chained_ns = ns_per_op(N / 10, [&](int i) {
+    for (int e = 0; e < corpus_size; e++) {
+      time_t t = SEASON_START + i * 37;
+      for (int k = 0; k < AGENDA_N; k++) {
+        t = agenda[k] = cron_next(&exprs[e], t);
+      }
+    }
+  });
+  double batch_ns = ns_per_op(N / 10, [&](int i) {
+    for (int e = 0; e < corpus_size; e++) {
+      cron_next_n(&exprs[e], SEASON_START + i * 37, agenda, AGENDA_N);
+    }
+  });
+
+  StationController ctr;
+  ctr.init(&time_client);
+  double event_ns = ns_per_op(N, [&](int) {
+    ctr.next_station_event();
+  });
+
+  // a mix of retained config/state messages, including an oversized malformed payload
+  static std::string oversized(2048, '9');
+  static const char *MESSAGES[][2] = {
+    {"lawn-irrigation/station1/config", "0 0 6 * * *|900"},
+    {"lawn-irrigation/station2/config", "0 20 6 * * MON,WED,FRI|600|1500"},
+    {"lawn-irrigation/enabled/set", "on"},
+    {"lawn-irrigation/interface-mode/set", "off"},
+    {"lawn-irrigation/station3/set", "on|60"},
+    {"lawn-irrigation/station3/config", oversized.c_str()},
+  };
+  const int message_count = sizeof(MESSAGES) / sizeof(MESSAGES[0]);
+  double message_ns = ns_per_op(N, [&](int i) {
+    sim::deliver_now(MESSAGES[i % message_count][0], MESSAGES[i % message_count][1]);
+  });
+
+  static const char *TOPICS[] = {
+    "lawn-irrigation/interface-mode/set",
+    "lawn-irrigation/enabled/set",
+    "lawn-irrigation/station1/set",
+    "lawn-irrigation/station3/config",
+    "lawn-irrigation/station4/state",
+    "lawn-irrigation/log",
+  };
+  const int topic_count = sizeof(TOPICS) / sizeof(TOPICS[0]);
+  volatile int sink = 0;
+  double legacy_route_ns = ns_per_op(N * 10, [&](int i) {
+    sink = sink + legacy_route(TOPICS[i % topic_count]);
+  });
+  double route_ns = ns_per_op(N * 10, [&](int i) {
+    sink = sink + sprinkler_controller::topics::match(TOPICS[i % topic_count]).id;
+  });
+
+  printf("Benchmarks (host CPU, %d iterations)\n", N);
+  printf("  cron_parse_expr():     %10.0f ns/op, %.1f allocs/op, %.0f bytes/op\n", parse_ns, (double)allocs / N, (double)alloc_bytes / N);
+  printf("  cron_next():           %10.0f ns/op\n", next_ns);
+  printf("  cron_next() sparse:    %10.0f ns/op (upstream %.0f ns/op)\n", sparse_ns, ref_sparse_ns);
+  printf("  cron_next() dense:     %10.0f ns/op (upstream %.0f ns/op)\n", dense_ns, ref_dense_ns);
+  printf("  agenda, cron_next():   %10.0f ns/op (%d expressions x %d dates)\n", chained_ns, corpus_size, AGENDA_N);
+  printf("  agenda, cron_next_n(): %10.0f ns/op\n", batch_ns);
+  printf("  next_station_event():  %10.0f ns/op\n", event_ns);
+  printf("  topic routing, chain:  %10.1f ns/op\n", legacy_route_ns);
+  printf("  topic routing, table:  %10.1f ns/op\n", route_ns);
+  printf("  MQTT callback:         %10.0f msgs/s\n", 1e9 / message_ns);
+}
+
+int main(int argc, char **argv) {
+  setenv("TZ", "UTC", 1);
+  tzset();
+
+  sim::verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+  int mismatches = checks::cron_parser() + checks::cron_bit_search() + checks::storage_records();
+  if (mismatches != 0) {
+    fflush(stdout);
+    fprintf(stderr, "FAILED: %d mismatches in the checks\n", mismatches);
+    return 1;
+  }
+
+  time_client.forceUpdate();
+  sim::set_epoch(SEASON_START);
+  configure_broker();
+
+  run_season();
+  run_interface_session();
+  run_benchmarks();
+
+  return 0;
+}
@@ -57,17 +57,7 @@ static const char* const MONTHS_ARR[] = { "FOO", "JAN", "FEB", "MAR", "APR", "MA
 #define CRON_MONTHS_ARR_LEN 13
 
 #define CRON_MAX_STR_LEN_TO_SPLIT 256
-#define CRON_MAX_NUM_TO_SRING 1000000000
-/* computes number of digits in decimal number */
-#define CRON_NUM_OF_DIGITS(num) (abs(num) < 10 ? 1 : \
-                                (abs(num) < 100 ? 2 : \
-                                (abs(num) < 1000 ? 3 : \
-                                (abs(num) < 10000 ? 4 : \
-                                (abs(num) < 100000 ? 5 : \
-                                (abs(num) < 1000000 ? 6 : \
-                                (abs(num) < 10000000 ? 7 : \
-                                (abs(num) < 100000000 ? 8 : \
-                                (abs(num) < 1000000000 ? 9 : 10)))))))))
+#define CRON_FIELDS_LEN 6
 
 #ifndef CRON_TEST_MALLOC
 #define cron_malloc(x) malloc(x);
@@ -218,34 +208,43 @@ uint8_t cron_get_bit(uint8_t* rbyte, int idx) {
     }
 }
 
-static void free_splitted(char** splitted, size_t len) {
-    size_t i;
-    if (!splitted) return;
-    for (i = 0; i < len; i++) {
-        if (splitted[i]) {
-            cron_free(splitted[i]);
-        }
+/**
+ * The field bitsets are searched 32 bits at a time. Words are assembled from
+ * the bytes of the field so that the byte layout of cron_expr stays the same
+ * and no byte past the end of a field is read.
+ */
+static uint32_t load_bit_word(const uint8_t* bits, unsigned int word, unsigned int nbytes) {
+    uint32_t res = 0;
+    unsigned int i;
+    unsigned int byte = word * 4;
+    for (i = 0; i < 4 && byte + i < nbytes; i++) {
+        res |= ((uint32_t) bits[byte + i]) << (8 * i);
     }
-    cron_free(splitted);
-}
-
-static char* strdupl(const char* str, size_t len) {
-    if (!str) return NULL;
-    char* res = (char*) cron_malloc(len + 1);
-    if (!res) return NULL;
-    memset(res, 0, len + 1);
-    memcpy(res, str, len);
     return res;
 }
 
 static unsigned int next_set_bit(uint8_t* bits, unsigned int max, unsigned int from_index, int* notfound) {
-    unsigned int i;
-    if (!bits) {
+    unsigned int word;
+    unsigned int nbytes;
+    uint32_t w;
+    if (!bits || from_index >= max) {
         *notfound = 1;
         return 0;
     }
-    for (i = from_index; i < max; i++) {
-        if (cron_get_bit(bits, i)) return i;
+    /* the current value usually matches already */
+    if (cron_get_bit(bits, from_index)) return from_index;
+    nbytes = (max + 7) / 8;
+    word = from_index / 32;
+    w = load_bit_word(bits, word, nbytes) & (0xFFFFFFFFu << (from_index % 32));
+    for (;;) {
+        if (w) {
+            unsigned int i = word * 32 + (unsigned int) __builtin_ctz(w);
+            if (i < max) return i;
+            break;
+        }
+        word++;
+        if (word * 32 >= max) break;
+        w = load_bit_word(bits, word, nbytes);
     }
     *notfound = 1;
     return 0;
@@ -443,8 +442,8 @@ static unsigned int find_next_day(struct tm* calendar, uint8_t* days_of_month, u
 static int do_next(cron_expr* expr, struct tm* calendar, unsigned int dot) {
     int i;
     int res = 0;
-    int* resets = NULL;
-    int* empty_list = NULL;
+    int resets[CRON_CF_ARR_LEN];
+    int empty_list[CRON_CF_ARR_LEN];
     unsigned int second = 0;
     unsigned int update_second = 0;
     unsigned int minute = 0;
@@ -457,10 +456,6 @@ static int do_next(cron_expr* expr, struct tm* calendar, unsigned int dot) {
     unsigned int month = 0;
     unsigned int update_month = 0;
 
-    resets = (int*) cron_malloc(CRON_CF_ARR_LEN * sizeof(int));
-    if (!resets) goto return_result;
-    empty_list = (int*) cron_malloc(CRON_CF_ARR_LEN * sizeof(int));
-    if (!empty_list) goto return_result;
     for (i = 0; i < CRON_CF_ARR_LEN; i++) {
         resets[i] = -1;
         empty_list[i] = -1;
@@ -518,77 +513,15 @@ static int do_next(cron_expr* expr, struct tm* calendar, unsigned int dot) {
     goto return_result;
 
     return_result:
-    if (!resets || !empty_list) {
-        res = -1;
-    }
-    if (resets) {
-        cron_free(resets);
-    }
-    if (empty_list) {
-        cron_free(empty_list);
-    }
     return res;
 }
 
-static int to_upper(char* str) {
-    if (!str) return 1;
+static void to_upper(char* str) {
     int i;
     for (i = 0; '\0' != str[i]; i++) {
         int c = (int)str[i];
         str[i] = (char) toupper(c);
     }
-    return 0;
-}
-
-static char* to_string(int num) {
-    if (abs(num) >= CRON_MAX_NUM_TO_SRING) return NULL;
-    char* str = (char*) cron_malloc(CRON_NUM_OF_DIGITS(num) + 1);
-    if (!str) return NULL;
-    int res = sprintf(str, "%d", num);
-    if (res < 0) {
-        cron_free(str);
-        return NULL;
-    }
-    return str;
-}
-
-static char* str_replace(char *orig, const char *rep, const char *with) {
-    char *result; /* the return string */
-    char *ins; /* the next insert point */
-    char *tmp; /* varies */
-    size_t len_rep; /* length of rep */
-    size_t len_with; /* length of with */
-    size_t len_front; /* distance between rep and end of last rep */
-    int count; /* number of replacements */
-    if (!orig) return NULL;
-    if (!rep) rep = "";
-    if (!with) with = "";
-    len_rep = strlen(rep);
-    len_with = strlen(with);
-
-    ins = orig;
-    for (count = 0; NULL != (tmp = strstr(ins, rep)); ++count) {
-        ins = tmp + len_rep;
-    }
-
-    /* first time through the loop, all the variable are set correctly
-     from here on,
-     tmp points to the end of the result string
-     ins points to the next occurrence of rep in orig
-     orig points to the remainder of orig after "end of rep"
-     */
-    tmp = result = (char*) cron_malloc(strlen(orig) + (len_with - len_rep) * count + 1);
-    if (!result) return NULL;
-
-    while (count--) {
-        ins = strstr(orig, rep);
-        len_front = ins - orig;
-        tmp = strncpy(tmp, orig, len_front) + len_front;
-        tmp = strcpy(tmp, with) + len_with;
-        orig += len_front + len_rep; /* move to next "end of rep" */
-    }
-    strcpy(tmp, orig);
-    return result;
 }
 
 static unsigned int parse_uint(const char* str, int* errcode) {
@@ -604,279 +537,181 @@ static unsigned int parse_uint(const char* str, int* errcode) {
     }
 }
 
-static char** split_str(const char* str, char del, size_t* len_out) {
-    size_t i;
-    size_t stlen = 0;
-    size_t len = 0;
-    int accum = 0;
-    char* buf = NULL;
-    char** res = NULL;
-    size_t bi = 0;
-    size_t ri = 0;
-    char* tmp;
-
-    if (!str) goto return_error;
-    for (i = 0; '\0' != str[i]; i++) {
-        stlen += 1;
-        if (stlen >= CRON_MAX_STR_LEN_TO_SPLIT) goto return_error;
-    }
-    
-    for (i = 0; i < stlen; i++) {
-        int c = str[i];
-        if (del == str[i]) {
-            if (accum > 0) {
-                len += 1;
-                accum = 0;
-            }
-        } else if (!isspace(c)) {
-            accum += 1;
-        }
-    }
-    /* tail */
-    if (accum > 0) {
-        len += 1;
-    }
-    if (0 == len) return NULL;
-
-    buf = (char*) cron_malloc(stlen + 1);
-    if (!buf) goto return_error;
-    memset(buf, 0, stlen + 1);
-    res = (char**) cron_malloc(len * sizeof(char*));
-    if (!res) goto return_error;
-    memset(res, 0, len * sizeof(char*));
-
-    for (i = 0; i < stlen; i++) {
-        int c = str[i];
-        if (del == str[i]) {
-            if (bi > 0) {
-                tmp = strdupl(buf, bi);
-                if (!tmp) goto return_error;
-                res[ri++] = tmp;
-                memset(buf, 0, stlen + 1);
-                bi = 0;
-            }
-        } else if (!isspace(c)) {
-            buf[bi++] = str[i];
-        }
+/**
+ * The parser works in place on a copy of the expression on the stack and never
+ * allocates. Tokens are terminated by overwriting their delimiter, and empty
+ * tokens are skipped like the original heap based splitter did.
+ */
+static char* next_token(char** cursor, char del) {
+    char* start = *cursor;
+    char* end;
+    while (del == *start) start++;
+    if ('\0' == *start) {
+        *cursor = start;
+        return NULL;
     }
-    /* tail */
-    if (bi > 0) {
-        tmp = strdupl(buf, bi);
-        if (!tmp) goto return_error;
-        res[ri++] = tmp;
+    end = start;
+    while ('\0' != *end && del != *end) end++;
+    if ('\0' != *end) {
+        *end = '\0';
+        *cursor = end + 1;
+    } else {
+        *cursor = end;
     }
-    cron_free(buf);
-    *len_out = len;
-    return res;
+    return start;
+}
 
-    return_error:
-    if (buf) {
-        cron_free(buf);
+/* returns the number of tokens, only the first max_tokens are stored */
+static size_t split_in_place(char* str, char del, char** tokens, size_t max_tokens) {
+    size_t count = 0;
+    char* cursor = str;
+    char* token;
+    while (NULL != (token = next_token(&cursor, del))) {
+        if (count < max_tokens) {
+            tokens[count] = token;
+        }
+        count++;
     }
-    free_splitted(res, len);
-    *len_out = 0;
-    return NULL;
+    return count;
 }
 
-static char* replace_ordinals(char* value, const char* const * arr, size_t arr_len) {
+/* names are replaced by their index, which is never longer than the name itself */
+static void replace_ordinals(char* value, const char* const * arr, size_t arr_len) {
     size_t i;
-    char* cur = value;
-    char* res = NULL;
-    int first = 1;
     for (i = 0; i < arr_len; i++) {
-        char* strnum = to_string((int) i);
-        if (!strnum) {
-            if (!first) {
-                cron_free(cur);
-            }
-            return NULL;
-        }
-        res = str_replace(cur, arr[i], strnum);
-        cron_free(strnum);
-        if (!first) {
-            cron_free(cur);
+        char num[3];
+        size_t num_len = 0;
+        size_t name_len = strlen(arr[i]);
+        char* pos = value;
+        if (i >= 10) {
+            num[num_len++] = (char) ('0' + i / 10);
         }
-        if (!res) {
-            return NULL;
-        }
-        cur = res;
-        if (first) {
-            first = 0;
+        num[num_len++] = (char) ('0' + i % 10);
+        while (NULL != (pos = strstr(pos, arr[i]))) {
+            memcpy(pos, num, num_len);
+            memmove(pos + num_len, pos + name_len, strlen(pos + name_len) + 1);
+            pos += num_len;
         }
     }
-    return res;
 }
 
-static int has_char(char* str, char ch) {
-    size_t i;
-    size_t len = 0;
-    if (!str) return 0;
-    len = strlen(str);
-    for (i = 0; i < len; i++) {
-        if (str[i] == ch) return 1;
-    }
-    return 0;
+static int has_char(const char* str, char ch) {
+    return NULL != strchr(str, ch);
 }
 
-static unsigned int* get_range(char* field, unsigned int min, unsigned int max, const char** error) {
-
-    char** parts = NULL;
-    size_t len = 0;
-    unsigned int* res = (unsigned int*) cron_malloc(2 * sizeof(unsigned int));
-    if (!res) goto return_error;
-
-    res[0] = 0;
-    res[1] = 0;
+static void get_range(char* field, unsigned int min, unsigned int max, unsigned int* range, const char** error) {
+    range[0] = 0;
+    range[1] = 0;
     if (1 == strlen(field) && '*' == field[0]) {
-        res[0] = min;
-        res[1] = max - 1;
+        range[0] = min;
+        range[1] = max - 1;
     } else if (!has_char(field, '-')) {
         int err = 0;
         unsigned int val = parse_uint(field, &err);
         if (err) {
             *error = "Unsigned integer parse error 1";
-            goto return_error;
+            return;
         }
 
-        res[0] = val;
-        res[1] = val;
+        range[0] = val;
+        range[1] = val;
     } else {
-        parts = split_str(field, '-', &len);
-        if (2 != len) {
+        char* parts[2];
+        int err = 0;
+        if (2 != split_in_place(field, '-', parts, 2)) {
             *error = "Specified range requires two fields";
-            goto return_error;
+            return;
         }
-        int err = 0;
-        res[0] = parse_uint(parts[0], &err);
+        range[0] = parse_uint(parts[0], &err);
         if (err) {
             *error = "Unsigned integer parse error 2";
-            goto return_error;
+            return;
         }
-        res[1] = parse_uint(parts[1], &err);
+        range[1] = parse_uint(parts[1], &err);
         if (err) {
             *error = "Unsigned integer parse error 3";
-            goto return_error;
+            return;
         }
     }
-    if (res[0] >= max || res[1] >= max) {
+    if (range[0] >= max || range[1] >= max) {
         *error = "Specified range exceeds maximum";
-        goto return_error;
+        return;
     }
-    if (res[0] < min || res[1] < min) {
+    if (range[0] < min || range[1] < min) {
         *error = "Specified range is less than minimum";
-        goto return_error;
+        return;
     }
-    if (res[0] > res[1]) {
+    if (range[0] > range[1]) {
         *error = "Specified range start exceeds range end";
-        goto return_error;
+        return;
     }
 
-    free_splitted(parts, len);
     *error = NULL;
-    return res;
-
-    return_error:
-    free_splitted(parts, len);
-    if (res) {
-        cron_free(res);
-    }
-
-    return NULL;
 }
 
-static void set_number_hits(const char* value, uint8_t* target, unsigned int min, unsigned int max, const char** error) {
-    size_t i;
+static void set_number_hits(char* value, uint8_t* target, unsigned int min, unsigned int max, const char** error) {
     unsigned int i1;
-    size_t len = 0;
+    unsigned int range[2];
+    char* cursor = value;
+    char* field = next_token(&cursor, ',');
 
-    char** fields = split_str(value, ',', &len);
-    if (!fields) {
+    if (!field) {
         *error = "Comma split error";
-        goto return_result;
+        return;
     }
 
-    for (i = 0; i < len; i++) {
-        if (!has_char(fields[i], '/')) {
+    for (; NULL != field; field = next_token(&cursor, ',')) {
+        if (!has_char(field, '/')) {
             /* Not an incrementer so it must be a range (possibly empty) */
 
-            unsigned int* range = get_range(fields[i], min, max, error);
-
+            get_range(field, min, max, range, error);
             if (*error) {
-                if (range) {
-                    cron_free(range);
-                }
-                goto return_result;
-
+                return;
             }
 
             for (i1 = range[0]; i1 <= range[1]; i1++) {
                 cron_set_bit(target, i1);
-
             }
-            cron_free(range);
 
         } else {
-            size_t len2 = 0;
-            char** split = split_str(fields[i], '/', &len2);
-            if (2 != len2) {
+            char* split[2];
+            int has_range;
+            if (2 != split_in_place(field, '/', split, 2)) {
                 *error = "Incrementer must have two fields";
-                free_splitted(split, len2);
-                goto return_result;
+                return;
             }
-            unsigned int* range = get_range(split[0], min, max, error);
+            has_range = has_char(split[0], '-');
+            get_range(split[0], min, max, range, error);
             if (*error) {
-                if (range) {
-                    cron_free(range);
-                }
-                free_splitted(split, len2);
-                goto return_result;
+                return;
             }
-            if (!has_char(split[0], '-')) {
+            if (!has_range) {
                 range[1] = max - 1;
             }
             int err = 0;
             unsigned int delta = parse_uint(split[1], &err);
             if (err) {
                 *error = "Unsigned integer parse error 4";
-                cron_free(range);
-                free_splitted(split, len2);
-                goto return_result;
+                return;
             }
             if (0 == delta) {
                 *error = "Incrementer may not be zero";
-                cron_free(range);
-                free_splitted(split, len2);
-                goto return_result;
+                return;
             }
             for (i1 = range[0]; i1 <= range[1]; i1 += delta) {
                 cron_set_bit(target, i1);
             }
-            free_splitted(split, len2);
-            cron_free(range);
-
         }
     }
-    goto return_result;
-
-    return_result:
-    free_splitted(fields, len);
-
 }
 
 static void set_months(char* value, uint8_t* targ, const char** error) {
     unsigned int i;
     unsigned int max = 12;
 
-    char* replaced = NULL;
-
     to_upper(value);
-    replaced = replace_ordinals(value, MONTHS_ARR, CRON_MONTHS_ARR_LEN);
-    if (!replaced) {
-        *error = "Invalid month format";
-        return;
-    }
-    set_number_hits(replaced, targ, 1, max + 1, error);
-    cron_free(replaced);
+    replace_ordinals(value, MONTHS_ARR, CRON_MONTHS_ARR_LEN);
+    set_number_hits(value, targ, 1, max + 1, error);
 
     /* ... and then rotate it to the front of the months */
     for (i = 1; i <= max; i++) {
@@ -889,19 +724,13 @@ static void set_months(char* value, uint8_t* targ, const char** error) {
 
 static void set_days_of_week(char* field, uint8_t* targ, const char** error) {
     unsigned int max = 7;
-    char* replaced = NULL;
 
     if (1 == strlen(field) && '?' == field[0]) {
         field[0] = '*';
     }
     to_upper(field);
-    replaced = replace_ordinals(field, DAYS_ARR, CRON_DAYS_ARR_LEN);
-    if (!replaced) {
-        *error = "Invalid day format";
-        return;
-    }
-    set_number_hits(replaced, targ, 0, max + 1, error);
-    cron_free(replaced);
+    replace_ordinals(field, DAYS_ARR, CRON_DAYS_ARR_LEN);
+    set_number_hits(field, targ, 0, max + 1, error);
     if (cron_get_bit(targ, 7)) {
         /* Sunday can be represented as 0 or 7*/
         cron_set_bit(targ, 0);
@@ -919,44 +748,52 @@ static void set_days_of_month(char* field, uint8_t* targ, const char** error) {
 
 void cron_parse_expr(const char* expression, cron_expr* target, const char** error) {
     const char* err_local;
+    char buf[CRON_MAX_STR_LEN_TO_SPLIT];
+    char* fields[CRON_FIELDS_LEN];
+    size_t i;
     size_t len = 0;
-    char** fields = NULL;
     if (!error) {
         error = &err_local;
     }
     *error = NULL;
     if (!expression) {
         *error = "Invalid NULL expression";
-        goto return_res;
+        return;
     }
     if (!target) {
         *error = "Invalid NULL target";
-        goto return_res;
+        return;
+    }
+
+    /* fields are separated by spaces, any other whitespace is dropped */
+    for (i = 0; '\0' != expression[i]; i++) {
+        int c = expression[i];
+        if (len + 1 >= CRON_MAX_STR_LEN_TO_SPLIT) {
+            *error = "Invalid number of fields, expression must consist of 6 fields";
+            return;
+        }
+        if (' ' == c || !isspace(c)) {
+            buf[len++] = (char) c;
+        }
     }
+    buf[len] = '\0';
 
-    fields = split_str(expression, ' ', &len);
-    if (len != 6) {
+    if (CRON_FIELDS_LEN != split_in_place(buf, ' ', fields, CRON_FIELDS_LEN)) {
         *error = "Invalid number of fields, expression must consist of 6 fields";
-        goto return_res;
+        return;
     }
     memset(target, 0, sizeof(*target));
     set_number_hits(fields[0], target->seconds, 0, 60, error);
-    if (*error) goto return_res;
+    if (*error) return;
     set_number_hits(fields[1], target->minutes, 0, 60, error);
-    if (*error) goto return_res;
+    if (*error) return;
     set_number_hits(fields[2], target->hours, 0, 24, error);
-    if (*error) goto return_res;
+    if (*error) return;
     set_days_of_month(fields[3], target->days_of_month, error);
-    if (*error) goto return_res;
+    if (*error) return;
     set_months(fields[4], target->months, error);
-    if (*error) goto return_res;
+    if (*error) return;
     set_days_of_week(fields[5], target->days_of_week, error);
-    if (*error) goto return_res;
-
-    goto return_res;
-
-    return_res: 
-    free_splitted(fields, len);
 }
 
 time_t cron_next(cron_expr* expr, time_t date) {
@@ -997,17 +834,59 @@ time_t cron_next(cron_expr* expr, time_t date) {
     return cron_mktime(calendar);
 }
 
+size_t cron_next_n(cron_expr* expr, time_t date, time_t* out, size_t n) {
+    size_t count = 0;
+    if (!expr || !out || 0 == n) return 0;
+    struct tm calval;
+    memset(&calval, 0, sizeof(struct tm));
+    struct tm* calendar = cron_time(&date, &calval);
+    if (!calendar) return 0;
+    time_t previous = cron_mktime(calendar);
+    if (CRON_INVALID_INSTANT == previous) return 0;
+
+    /* the first step is the same as cron_next(), the calendar then stays broken down between steps */
+    while (count < n) {
+        int res = do_next(expr, calendar, calendar->tm_year);
+        if (0 != res) break;
+        time_t calculated = cron_mktime(calendar);
+        if (CRON_INVALID_INSTANT == calculated) break;
+        if (calculated == previous) {
+            res = add_to_field(calendar, CRON_CF_SECOND, 1);
+            if (0 != res) break;
+            continue;
+        }
+        out[count++] = calculated;
+        previous = calculated;
+    }
+    return count;
+}
+
 
 /* https://github.com/staticlibs/ccronexpr/pull/8 */
 
 static unsigned int prev_set_bit(uint8_t* bits, int from_index, int to_index, int* notfound) {
-    int i;
-    if (!bits) {
+    unsigned int word;
+    unsigned int nbytes;
+    unsigned int shift;
+    uint32_t w;
+    if (!bits || from_index < to_index || from_index < 0) {
         *notfound = 1;
         return 0;
     }
-    for (i = from_index; i >= to_index; i--) {
-        if (cron_get_bit(bits, i)) return i;
+    if (cron_get_bit(bits, from_index)) return (unsigned int) from_index;
+    nbytes = (unsigned int) from_index / 8 + 1;
+    word = (unsigned int) from_index / 32;
+    shift = 31 - (unsigned int) from_index % 32;
+    w = load_bit_word(bits, word, nbytes) & (0xFFFFFFFFu >> shift);
+    for (;;) {
+        if (w) {
+            int i = (int) (word * 32 + 31 - (unsigned int) __builtin_clz(w));
+            if (i >= to_index) return (unsigned int) i;
+            break;
+        }
+        if (0 == word) break;
+        word--;
+        w = load_bit_word(bits, word, nbytes);
     }
     *notfound = 1;
     return 0;
@@ -1134,8 +1013,8 @@ static unsigned int find_prev_day(struct tm* calendar, uint8_t* days_of_month, u
 static int do_prev(cron_expr* expr, struct tm* calendar, unsigned int dot) {
     int i;
     int res = 0;
-    int* resets = NULL;
-    int* empty_list = NULL;
+    int resets[CRON_CF_ARR_LEN];
+    int empty_list[CRON_CF_ARR_LEN];
     unsigned int second = 0;
     unsigned int update_second = 0;
     unsigned int minute = 0;
@@ -1148,10 +1027,6 @@ static int do_prev(cron_expr* expr, struct tm* calendar, unsigned int dot) {
     unsigned int month = 0;
     unsigned int update_month = 0;
 
-    resets = (int*) cron_malloc(CRON_CF_ARR_LEN * sizeof(int));
-    if (!resets) goto return_result;
-    empty_list = (int*) cron_malloc(CRON_CF_ARR_LEN * sizeof(int));
-    if (!empty_list) goto return_result;
     for (i = 0; i < CRON_CF_ARR_LEN; i++) {
         resets[i] = -1;
         empty_list[i] = -1;
@@ -1209,15 +1084,6 @@ static int do_prev(cron_expr* expr, struct tm* calendar, unsigned int dot) {
     goto return_result;
 
     return_result:
-    if (!resets || !empty_list) {
-        res = -1;
-    }
-    if (resets) {
-        cron_free(resets);
-    }
-    if (empty_list) {
-        cron_free(empty_list);
-    }
     return res;
 }
 
@@ -1259,4 +1125,14 @@ time_t cron_prev(cron_expr* expr, time_t date) {
     }
 
     return cron_mktime(calendar);
-}
\ No newline at end of file
+}
+#ifdef CRON_TEST_MALLOC
+/* the bit searches are static, these expose them to the host checks */
+unsigned int cron_test_next_set_bit(uint8_t* bits, unsigned int max, unsigned int from_index, int* notfound) {
+    return next_set_bit(bits, max, from_index, notfound);
+}
+
+unsigned int cron_test_prev_set_bit(uint8_t* bits, int from_index, int to_index, int* notfound) {
+    return prev_set_bit(bits, from_index, to_index, notfound);
+}
+#endif /* CRON_TEST_MALLOC */
@@ -75,6 +75,20 @@ void cron_parse_expr(const char* expression, cron_expr* target, const char** err
  */
 time_t cron_next(cron_expr* expr, time_t date);
 
+/**
+ * Fills 'out' with the next 'n' fire dates after the specified date, in
+ * ascending order. The result is the same as chaining cron_next() calls, but
+ * the broken-down calendar is kept between steps instead of being rebuilt
+ * from a timestamp for every date.
+ *
+ * @param expr parsed cron expression to use in next date calculation
+ * @param date start date to start calculation from
+ * @param out array that receives the fire dates
+ * @param n maximum number of fire dates to calculate
+ * @return number of fire dates written to 'out', less than 'n' in case of error
+ */
+size_t cron_next_n(cron_expr* expr, time_t date, time_t* out, size_t n);
+
 /**
  * Uses the specified expression to calculate the previous 'fire' date after
  * the specified date. All dates are processed as UTC (GMT) dates 
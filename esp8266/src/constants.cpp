@@ -7,4 +7,8 @@ namespace sprinkler_controller {
     const char* MQTT_BROKER = "<MQTT_IP>";
     const char* MQTT_USER = "<MQTT_user>";
     const char* MQTT_PWD = "<MQTT_pwd>";
+
+    // Max time (in seconds) between two online wakes while in deep sleep mode. Config changes
+    // are picked up and the clock is resynced at least this often.
+    const int SYNC_INTERVAL = 12 * 60 * 60;
 }
\ No newline at end of file
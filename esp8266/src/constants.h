@@ -11,6 +11,8 @@ extern const char* MQTT_BROKER;
 extern const char* MQTT_USER;
 extern const char* MQTT_PWD;
 
+extern const int SYNC_INTERVAL;
+
 }
 
 #endif
@@ -0,0 +1,140 @@
+#include "eventlog.h"
+#include "log.h"
+#include "mqttcli.h"
+#include "record.h"
+#include "rtcstate.h"
+
+namespace sprinkler_controller::eventlog {
+
+static Ring s_ring;
+static bool s_loaded = false;
+static char s_text[EVENTLOG_TEXT_SIZE];
+
+static const char *EVENT_TYPES[] = {"NOOP", "START", "STOP"};
+
+static uint16_t checksum() {
+  uint16_t crc = s_ring.crc;
+  s_ring.crc = 0;
+  uint16_t result = crc16(reinterpret_cast<const uint8_t *>(&s_ring), sizeof(Ring));
+  s_ring.crc = crc;
+  return result;
+}
+
+// The ring is picked up from RTC memory on first use. It holds garbage after a power cycle.
+static void load() {
+  if (s_loaded) {
+    return;
+  }
+  s_loaded = true;
+
+  if (!ESP.rtcUserMemoryRead(RTC_EVENTLOG_BLOCK, reinterpret_cast<uint32_t *>(&s_ring), sizeof(Ring)) ||
+      s_ring.crc != checksum() || s_ring.head >= EVENTLOG_SIZE || s_ring.count > EVENTLOG_SIZE) {
+    memset(&s_ring, 0, sizeof(Ring));
+  }
+}
+
+static void save() {
+  s_ring.crc = checksum();
+  ESP.rtcUserMemoryWrite(RTC_EVENTLOG_BLOCK, reinterpret_cast<uint32_t *>(&s_ring), sizeof(Ring));
+}
+
+static int format(char *s, size_t size, const Entry &e) {
+  switch (e.code) {
+    case STARTED:
+      return snprintf(s, size, "[%u] Started. NTP retries: %u", e.time, e.a);
+    case STATION_START:
+      return snprintf(s, size, "[%u] Starting station %u. Duration = %u", e.time, e.a, e.c);
+    case STATION_STOP:
+      return snprintf(s, size, "[%u] Stopping station %u. Elapsed = %u/%u, Forced = %u", e.time, e.a, e.c, e.d, e.b);
+    case NOTHING_DUE:
+      return snprintf(s, size, "[%u] Nothing to do yet", e.time);
+    case START_OUT_OF_SYNC:
+      return snprintf(s, size, "[%u] Skipping START of station %u scheduled at %u, out of sync", e.time, e.a, e.c);
+    case START_DISABLED:
+      return snprintf(s, size, "[%u] Skipping START of station %u, irrigation is disabled", e.time, e.a);
+    case NEXT_EVENT:
+      return snprintf(s, size, "[%u] Next event: station %u %s at %u for %u", e.time, e.a, e.b < 3 ? EVENT_TYPES[e.b] : "?", e.c, e.d);
+    case NO_NEXT_EVENT:
+      return snprintf(s, size, "[%u] No next event found", e.time);
+    case DEEP_SLEEP:
+      return snprintf(s, size, "[%u] Deep sleep for %u seconds", e.time, e.c);
+    case CRON_TOO_LONG:
+      return snprintf(s, size, "[%u] CRON expr for station %u is too long", e.time, e.a);
+    case CRON_INVALID:
+      return snprintf(s, size, "[%u] Invalid CRON expr for station %u", e.time, e.a);
+    case STATE_DISCARDED:
+      return snprintf(s, size, "[%u] Discarding persisted state. Version: %u, CRC: %04x", e.time, e.a, e.b);
+    default:
+      return snprintf(s, size, "[%u] Event %u (%u, %u, %u, %u)", e.time, e.code, e.a, e.b, e.c, e.d);
+  }
+}
+
+void add(Code code, time_t time, uint8_t a, uint16_t b, uint32_t c, uint32_t d) {
+  load();
+
+  if (s_ring.count == EVENTLOG_SIZE) {
+    s_ring.head = (s_ring.head + 1) % EVENTLOG_SIZE;
+    s_ring.count--;
+    s_ring.lost++;
+  }
+
+  s_ring.entries[(s_ring.head + s_ring.count) % EVENTLOG_SIZE] = {(uint32_t)time, code, a, b, c, d};
+  s_ring.count++;
+
+  save();
+
+#ifdef DEBUGGING
+  format(s_text, sizeof(s_text), s_ring.entries[(s_ring.head + s_ring.count - 1) % EVENTLOG_SIZE]);
+  debug_printf("%s\n", s_text);
+#endif
+}
+
+/**
+ * Publishes the pending entries, one per line. Entries that don't fit in
+ * EVENTLOG_TEXT_SIZE stay in the ring for the next flush.
+ **/
+bool flush() {
+  load();
+
+  if (s_ring.count == 0 || !mqttcli::connected()) {
+    return false;
+  }
+
+  size_t length = 0;
+  if (s_ring.lost > 0) {
+    length = snprintf(s_text, sizeof(s_text), "(%u entries lost)", s_ring.lost);
+  }
+
+  uint8_t flushed = 0;
+  while (flushed < s_ring.count) {
+    const Entry &e = s_ring.entries[(s_ring.head + flushed) % EVENTLOG_SIZE];
+    size_t sep = length > 0 ? 1 : 0;
+    int n = format(s_text + length + sep, sizeof(s_text) - length - sep, e);
+    if (n < 0 || length + sep + n >= sizeof(s_text)) {
+      break;
+    }
+    if (sep) {
+      s_text[length] = '\n';
+    }
+    length += sep + n;
+    flushed++;
+  }
+
+  if (!mqttcli::publish(EVENTLOG_TOPIC, (const uint8_t *)s_text, length, true)) {
+    return false;
+  }
+
+  s_ring.head = (s_ring.head + flushed) % EVENTLOG_SIZE;
+  s_ring.count -= flushed;
+  s_ring.lost = 0;
+  save();
+
+  return true;
+}
+
+uint8_t pending() {
+  load();
+  return s_ring.count;
+}
+
+} // namespace sprinkler_controller::eventlog
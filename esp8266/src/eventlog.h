@@ -0,0 +1,60 @@
+#pragma once
+#ifndef _EVENTLOG_H_
+#define _EVENTLOG_H_
+
+#include <Arduino.h>
+
+#define EVENTLOG_SIZE 12 // entries kept until the next flush, the oldest are dropped first
+#define EVENTLOG_TEXT_SIZE 1024 // largest batch published at once
+#define EVENTLOG_TOPIC "lawn-irrigation/log"
+
+/**
+ * Log of controller events kept as codes and raw arguments. The entries are
+ * mirrored to RTC memory so that they survive deep sleep, and are only turned
+ * into text when flush() publishes them, all in one retained message.
+ **/
+namespace sprinkler_controller::eventlog {
+
+enum Code : uint8_t {
+  STARTED,           // a: NTP retries
+  STATION_START,     // a: station, c: duration
+  STATION_STOP,      // a: station, b: forced, c: elapsed, d: active duration
+  NOTHING_DUE,
+  START_OUT_OF_SYNC, // a: station, c: scheduled time
+  START_DISABLED,    // a: station
+  NEXT_EVENT,        // a: station, b: event type, c: event time, d: duration
+  NO_NEXT_EVENT,
+  DEEP_SLEEP,        // c: sleep duration
+  CRON_TOO_LONG,     // a: station
+  CRON_INVALID,      // a: station
+  STATE_DISCARDED,   // a: version, b: crc
+};
+
+struct Entry {
+  uint32_t time;
+  uint8_t code;
+  uint8_t a;
+  uint16_t b;
+  uint32_t c;
+  uint32_t d;
+};
+
+/**
+ * The log as kept in RTC memory from RTC_EVENTLOG_BLOCK on
+ **/
+struct Ring {
+  uint8_t head;
+  uint8_t count;
+  uint16_t lost; // entries overwritten before they were flushed
+  uint16_t crc;
+  uint16_t reserved;
+  Entry entries[EVENTLOG_SIZE];
+};
+
+void add(Code code, time_t time, uint8_t a = 0, uint16_t b = 0, uint32_t c = 0, uint32_t d = 0);
+bool flush();
+uint8_t pending();
+
+} // namespace sprinkler_controller::eventlog
+
+#endif
@@ -16,20 +16,6 @@ inline void debug_printf(const char * fmt, ...) {
 #endif
 }
 
-inline void report_log(const char* fmt, ...) {
-  va_list args;
-  va_start(args, fmt);
-  char msg[200];
-  
-  vsprintf(msg, fmt, args);
-  #ifdef DEBUGGING
-  debug_printf(strcat(msg, "\n"));
-  #endif
-  sprinkler_controller::mqttcli::publish("lawn-irrigation/log", msg, true);
-  
-  va_end(args);
-}
-
 inline void setupSerial() {
     #ifdef DEBUGGING
     Serial.begin(9600);
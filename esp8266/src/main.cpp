@@ -20,7 +20,7 @@
  * MQTT topics:
  *  Subsribe:
  *   - lawn-irrigation/station{x}/set     not retained -> payload: on|18000 ; off
- *   - lawn-irrigation/station{x}/config      retained -> payload: cron|18000
+ *   - lawn-irrigation/station{x}/config      retained -> payload: cron|18000[|pulse_ms]
  *   - lawn-irrigation/interface-mode/set     retained -> payload: on ; off
  *   - lawn-irrigation/enabled/set            retained -> payload: on ; off
  * 
@@ -28,6 +28,7 @@
  *   - lawn-irrigation/station{x}/state
  *   - lawn-irrigation/interface-mode/state
  *   - lawn-irrigation/log
+ *   - lawn-irrigation/telemetry
  *
  * @file main.cpp
  * @author Bruno Conde
@@ -43,13 +44,25 @@
 #include <NTPClient.h>
 #include <WiFiUdp.h>
 #include <ArduinoOTA.h>
+#include <user_interface.h>
 
 #include "mqttcli.h"
 #include "stations.h"
 #include "log.h"
+#include "eventlog.h"
+#include "telemetry.h"
 #include "constants.h"
+#include "rtcstate.h"
+#include "valves.h"
 
 const int DEEP_SLEEP_THRESHOLD = 3 * 60 * 60; // 3 hours in seconds
+const int WAKE_WINDOW = 60; // an event closer than this (in seconds) requires an online wake
+const int MIN_DRIFT_SAMPLE = 60 * 60; // min sleep time (in seconds) to measure the deep sleep timer drift
+const int32_t MAX_DRIFT_PPM = 100000; // 10%, anything bigger is not a drift (e.g. reset while sleeping)
+const unsigned long WIFI_FAST_CONNECT_MS = 3000; // wait for the cached access point before scanning for it
+const unsigned long WIFI_CONNECT_MS = 30000; // scan and connect, before giving up until a later wake
+const time_t WIFI_RETRY_SLEEP = 5 * 60; // seconds
+const unsigned long WIFI_POLL_MS = 10;
 
 using namespace sprinkler_controller;
 
@@ -57,6 +70,96 @@ StationController stctr;
 WiFiUDP ntpUDP;
 NTPClient time_client(ntpUDP);
 
+// Deep sleep time in microseconds, compensated with the measured timer drift
+uint64_t sleep_micros(time_t seconds, int32_t drift_ppm) {
+  return (uint64_t)seconds * 1000000ULL * 1000000ULL / (1000000LL + drift_ppm);
+}
+
+bool woke_from_deep_sleep() {
+  return ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE;
+}
+
+// An online wake is needed to process the next event or to resync the config and clock
+bool wake_needs_radio(const rtcstate::WakeState &ws, time_t wake_time) {
+  if (ws.resync || wake_time + WAKE_WINDOW >= (time_t)ws.sync_epoch + SYNC_INTERVAL) {
+    return true;
+  }
+
+  return ws.event_type != EventType::NOOP && wake_time + WAKE_WINDOW >= (time_t)ws.event_time;
+}
+
+// The radio is only calibrated and powered on the next wake if that wake is going online
+void deep_sleep(rtcstate::WakeState &ws, time_t now, time_t sleep_duration) {
+  ws.rf_disabled = !wake_needs_radio(ws, now + sleep_duration);
+  rtcstate::save(ws);
+
+  ESP.deepSleep(sleep_micros(sleep_duration, ws.drift_ppm), ws.rf_disabled ? WAKE_RF_DISABLED : WAKE_RF_DEFAULT);
+}
+
+/**
+ * Goes straight back to sleep when nothing is due before the next wake,
+ * using the state kept in RTC memory. Returns only if this wake needs WiFi.
+ */
+void fast_path_sleep() {
+  rtcstate::WakeState ws;
+  if (!woke_from_deep_sleep()) {
+    return;
+  }
+
+  if (!rtcstate::load(ws)) {
+    // the previous sleep may have turned the radio off for this wake, and without the state
+    // there is no telling. Restart with it on, the cleared state sends that wake online.
+    rtcstate::clear();
+    ESP.deepSleep(1, WAKE_RF_DEFAULT);
+  }
+
+  // the sleep durations are drift compensated, so their sum is the elapsed time
+  time_t now = (time_t)ws.sync_epoch + ws.slept;
+
+  if (wake_needs_radio(ws, now)) {
+    if (ws.rf_disabled) {
+      // woke up earlier than expected with the radio off, restart with it on
+      ws.rf_disabled = false;
+      rtcstate::save(ws);
+      ESP.deepSleep(1, WAKE_RF_DEFAULT);
+    }
+    return;
+  }
+
+  time_t sleep_duration = DEEP_SLEEP_THRESHOLD;
+  if (ws.event_type != EventType::NOOP && (time_t)ws.event_time - now < sleep_duration) {
+    sleep_duration = ws.event_time - now;
+  }
+  time_t sync_due = (time_t)ws.sync_epoch + SYNC_INTERVAL;
+  if (sync_due - now < sleep_duration) {
+    sleep_duration = sync_due - now;
+  }
+
+  ws.slept += sleep_duration;
+
+  debug_printf("Nothing due. Back to sleep for %lld seconds.\n", (long long)sleep_duration);
+
+  telemetry::save_fast_wake();
+
+  deep_sleep(ws, now, sleep_duration);
+}
+
+// Refines the deep sleep drift estimate with the time elapsed since the last online wake
+void update_sleep_drift() {
+  rtcstate::WakeState ws;
+  if (!woke_from_deep_sleep() || !time_client.isTimeSet() || !rtcstate::load(ws) || ws.slept < MIN_DRIFT_SAMPLE) {
+    return;
+  }
+
+  int64_t elapsed = (int64_t)time_client.getEpochTime() - (millis() / 1000) - ws.sync_epoch;
+  int64_t drift = (1000000LL + ws.drift_ppm) * elapsed / ws.slept - 1000000LL;
+
+  if (drift > -MAX_DRIFT_PPM && drift < MAX_DRIFT_PPM) {
+    ws.drift_ppm = (int32_t)drift;
+    rtcstate::save(ws);
+  }
+}
+
 void enter_deep_sleep() {
   // Find out the next event
   time_t now = time_client.getEpochTime();
@@ -72,51 +175,157 @@ void enter_deep_sleep() {
       sleep_duration = new_sleep_duration;
     }
 
-    char msg[200] = {0};
-    ev.to_string(msg);
-    report_log("[%lld] Next event: %s", now, msg);
+    eventlog::add(eventlog::NEXT_EVENT, now, ev.id, ev.type, ev.time, ev.duration);
   } else {
     // There isn't a next event to process
-    report_log("[%lld] No next event found!", now);
+    eventlog::add(eventlog::NO_NEXT_EVENT, now);
   }
 
-  report_log("[%lld] Entering deep sleep mode for '%lld' seconds... good night!", now, sleep_duration);
+  // latching valves must complete their pulse before the power goes down
+  valves::wait_idle();
+
+  eventlog::add(eventlog::DEEP_SLEEP, now, 0, 0, sleep_duration);
+
+  // the whole wake is reported in one message, or kept in RTC memory for the next online wake
+  eventlog::flush();
+  telemetry::flush();
 
   mqttcli::disconnect();
 
-  ESP.deepSleep(sleep_duration * 1000 * 1000); // convert from seconds to microseconds
+  // keep the next event in RTC memory so that the following wakes can skip WiFi
+  rtcstate::WakeState ws;
+  int32_t drift_ppm = rtcstate::load(ws) ? ws.drift_ppm : 0;
+  if (time_client.isTimeSet()) {
+    ws.resync = false;
+    ws.event_id = ev.id;
+    ws.event_type = ev.type;
+    ws.event_time = ev.time;
+    ws.event_duration = ev.duration;
+    ws.sync_epoch = now;
+    ws.slept = sleep_duration;
+    ws.drift_ppm = drift_ppm;
+
+    telemetry::mark(telemetry::SLEEP);
+    telemetry::save(now);
+
+    deep_sleep(ws, now, sleep_duration);
+  } else {
+    // without a valid clock the next wake must go online
+    telemetry::mark(telemetry::SLEEP);
+    telemetry::save(now);
+
+    rtcstate::clear();
+    ESP.deepSleep(sleep_micros(sleep_duration, drift_ppm));
+  }
 }
 
+// Sleeps with the radio on when the network can't be reached, and tries again on the next wake
+void wifi_retry_sleep() {
+  debug_printf("WiFi unavailable. Retrying in %lld seconds.\n", (long long)WIFI_RETRY_SLEEP);
+
+  rtcstate::WakeState ws;
+  int32_t drift_ppm = 0;
+  if (rtcstate::load(ws)) {
+    // the retry is part of the sleep since the last online wake
+    ws.slept += WIFI_RETRY_SLEEP;
+    ws.rf_disabled = false;
+    rtcstate::save(ws);
+    drift_ppm = ws.drift_ppm;
+  } else {
+    rtcstate::clear();
+  }
+
+  ESP.deepSleep(sleep_micros(WIFI_RETRY_SLEEP, drift_ppm), WAKE_RF_DEFAULT);
+}
+
+// Waits up to timeout_ms for the WiFi connection
+bool wait_wifi(unsigned long timeout_ms) {
+  unsigned long started = millis();
+
+  while (WiFi.status() != WL_CONNECTED) {
+    if (millis() - started >= timeout_ms) {
+      return false;
+    }
+    delay(WIFI_POLL_MS);
+    telemetry::count(telemetry::WIFI_POLLS);
+  }
+
+  return true;
+}
+
+/**
+ * Connects straight to the access point of the last connection, kept in RTC
+ * memory, and only scans for the network when that fails. With WIFI_CACHE_IP
+ * the last lease is also reused as a static IP to skip DHCP, which is only
+ * safe when the router reserves that address for the controller.
+ */
 void init_wifi() {
   delay(100);
   // We start by connecting to the WiFi network
   debug_printf("Connecting to %s\n", SSID);
 
+  // the credentials are compiled in, there is no need to write them to flash on every wake
+  WiFi.persistent(false);
   WiFi.setAutoConnect(true);
   WiFi.setAutoReconnect(true);
 
-  WiFi.begin(SSID, PASSWORD);
+  rtcstate::WifiCache cache;
+  bool connected = false;
+  if (rtcstate::load(cache)) {
+#ifdef WIFI_CACHE_IP
+    WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+#endif
+    WiFi.begin(SSID, PASSWORD, cache.channel, cache.bssid);
+    connected = wait_wifi(WIFI_FAST_CONNECT_MS);
 
-  while (WiFi.status() != WL_CONNECTED) {
-    debug_printf(".");
-    delay(500);
+    if (!connected) {
+      debug_printf("Cached access point not found. Scanning...\n");
+      WiFi.disconnect();
+#ifdef WIFI_CACHE_IP
+      WiFi.config(0U, 0U, 0U); // back to DHCP
+#endif
+    }
+  }
+
+  if (!connected) {
+    telemetry::count(telemetry::WIFI_SCANS);
+    WiFi.begin(SSID, PASSWORD);
+    if (!wait_wifi(WIFI_CONNECT_MS)) {
+      wifi_retry_sleep();
+    }
   }
 
+  memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+  cache.channel = WiFi.channel();
+  cache.ip = WiFi.localIP();
+  cache.gateway = WiFi.gatewayIP();
+  cache.subnet = WiFi.subnetMask();
+  cache.dns = WiFi.dnsIP();
+  rtcstate::save(cache);
+
   randomSeed(micros());
 
   debug_printf("WiFi connected. IP address: %s\n", WiFi.localIP().toString().c_str());
 }
 
 void setup() {  
+  telemetry::begin();
+
   setupSerial();
 
+  fast_path_sleep();
+
   init_wifi();
+  telemetry::mark(telemetry::WIFI);
   time_client.begin();
 
   stctr.init(&time_client);
 
+  update_sleep_drift();
+
   if (!stctr.is_interface_mode()) {
     stctr.process_station_event();
+    telemetry::mark(telemetry::EVENTS);
     enter_deep_sleep();
   }
 
@@ -165,6 +374,8 @@ void loop() {
 
   if (WiFi.status() != WL_CONNECTED) {
     Serial.println("WiFi disconnected. Reconnecting...");
+    // finish any valve pulse before waiting for the network
+    valves::wait_idle();
     WiFi.reconnect();
     
     while (WiFi.status() != WL_CONNECTED) {
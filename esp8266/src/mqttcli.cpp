@@ -1,9 +1,15 @@
 #include "mqttcli.h"
 #include "log.h"
 #include "constants.h"
+#include "telemetry.h"
+#include "valves.h"
 
 #include <PubSubClient.h>
 
+#define BACKOFF_MIN_MS 1000UL
+#define BACKOFF_MAX_MS 60000UL
+#define CONNECT_TIMEOUT_MS 2000 // bounds the time a single connection attempt can block
+
 namespace sprinkler_controller::mqttcli {
 
 static WiFiClient espClient;
@@ -11,11 +17,17 @@ static PubSubClient mqtt_client(espClient);
 static char topics[10][40];
 static int topic_count = 0;
 
+static unsigned long backoff_ms = BACKOFF_MIN_MS;
+static unsigned long last_attempt = 0;
+static unsigned long next_attempt_delay = 0;
+
 static void mqtt_connect();
 
 void init(MQTT_CALLBACK_SIGNATURE, const char** _topics, int _topic_count)  {
   mqtt_client.setServer(MQTT_BROKER, 1883);
   mqtt_client.setCallback(callback);
+  mqtt_client.setSocketTimeout(CONNECT_TIMEOUT_MS / 1000);
+  espClient.setTimeout(CONNECT_TIMEOUT_MS);
 
   if (_topic_count > 10) {
     debug_printf("Too many subscriptions. Maximum is 10!\n");
@@ -25,15 +37,26 @@ void init(MQTT_CALLBACK_SIGNATURE, const char** _topics, int _topic_count)  {
     }
     topic_count = _topic_count;
 
+    backoff_ms = BACKOFF_MIN_MS;
     mqtt_connect();
   }
 }
 
 void loop() {
   if (!mqtt_client.connected()) {
-      mqtt_connect();
+    // never wait for the broker here, the caller has valves to look after. A connection
+    // attempt blocks, so none is made while a valve is being pulsed.
+    if (millis() - last_attempt < next_attempt_delay || valves::busy()) {
+      return;
     }
-    mqtt_client.loop();
+    mqtt_connect();
+  }
+
+  mqtt_client.loop();
+}
+
+bool connected() {
+  return mqtt_client.connected();
 }
 
 void publish(const char* topic, const char* payload, bool retained) {
@@ -41,32 +64,45 @@ void publish(const char* topic, const char* payload, bool retained) {
   mqtt_client.flush();
 }
 
+// Streams the payload, so it is not limited by the PubSubClient buffer size
+bool publish(const char* topic, const uint8_t* payload, size_t length, bool retained) {
+  if (!mqtt_client.beginPublish(topic, length, retained)) {
+    return false;
+  }
+  mqtt_client.write(payload, length);
+  bool sent = mqtt_client.endPublish();
+  mqtt_client.flush();
+  return sent;
+}
+
 void disconnect() {
   mqtt_client.disconnect();
 }
 
+// Single connection attempt. Failures are retried from loop() with a jittered exponential backoff.
 static void mqtt_connect() {
-  // Loop until we're connected. Max retries: 5
-  uint8_t retries = 0;
-  while (!mqtt_client.connected() && retries < 5) {
-    retries++;
-    debug_printf("Attempting MQTT connection...\n");
-    // Create a random client ID
-    char client_id[20];
-    sprintf(client_id, "ESP8266Client-%04ld",random(0xffff));
-    // Attempt to connect
-    if (mqtt_client.connect(client_id, MQTT_USER, MQTT_PWD)) {
-      debug_printf("connected\n");
-      // Here is where we need to subscribe again to all endpoints
-      for (int i = 0; i < topic_count; i++) {
-        mqtt_client.subscribe(topics[i]);
-      }
-    } else {
-      debug_printf("failed, rc=%d try again in 5 seconds", mqtt_client.state());
-
-      // Wait 5 seconds before retrying
-      delay(5000);
+  debug_printf("Attempting MQTT connection...\n");
+  last_attempt = millis();
+  telemetry::count(telemetry::MQTT_ATTEMPTS);
+
+  // Create a random client ID
+  char client_id[20];
+  sprintf(client_id, "ESP8266Client-%04ld",random(0xffff));
+  // Attempt to connect
+  if (mqtt_client.connect(client_id, MQTT_USER, MQTT_PWD)) {
+    debug_printf("connected\n");
+    backoff_ms = BACKOFF_MIN_MS;
+    next_attempt_delay = 0;
+    // Here is where we need to subscribe again to all endpoints
+    for (int i = 0; i < topic_count; i++) {
+      mqtt_client.subscribe(topics[i]);
     }
+  } else {
+    // wait between half and the full backoff so that clients don't retry in lockstep
+    next_attempt_delay = backoff_ms / 2 + random(backoff_ms / 2 + 1);
+    backoff_ms = backoff_ms * 2 > BACKOFF_MAX_MS ? BACKOFF_MAX_MS : backoff_ms * 2;
+
+    debug_printf("failed, rc=%d try again in %lu ms\n", mqtt_client.state(), next_attempt_delay);
   }
 }
 
@@ -10,7 +10,9 @@ namespace sprinkler_controller::mqttcli {
 
 void init(MQTT_CALLBACK_SIGNATURE, const char** topics, int topic_count);
 void loop();
+bool connected();
 void publish(const char* topic, const char* payload, bool retained);
+bool publish(const char* topic, const uint8_t* payload, size_t length, bool retained);
 void disconnect();
 
 } // namespace sprinkler_controller::mqttcli
@@ -0,0 +1,113 @@
+#include "record.h"
+
+namespace sprinkler_controller {
+
+// CRC-16/CCITT-FALSE
+uint16_t crc16(const uint8_t *data, size_t length) {
+  uint16_t crc = 0xFFFF;
+
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+
+  return crc;
+}
+
+void RecordWriter::u8(uint8_t v) {
+  if (pos + 1 > size) {
+    overflow = true;
+    return;
+  }
+  buf[pos++] = v;
+}
+
+void RecordWriter::u16(uint16_t v) {
+  u8(v & 0xFF);
+  u8(v >> 8);
+}
+
+void RecordWriter::u32(uint32_t v) {
+  u16(v & 0xFFFF);
+  u16(v >> 16);
+}
+
+void RecordWriter::bytes(const void *data, size_t length) {
+  if (pos + length > size) {
+    overflow = true;
+    return;
+  }
+  memcpy(buf + pos, data, length);
+  pos += length;
+}
+
+size_t RecordWriter::begin_section() {
+  size_t mark = pos;
+  u8(0); // length placeholder
+  return mark;
+}
+
+void RecordWriter::end_section(size_t mark) {
+  size_t length = pos - mark - 1;
+  if (overflow || length > 0xFF) {
+    overflow = true;
+    return;
+  }
+  buf[mark] = length;
+}
+
+uint8_t RecordReader::u8(uint8_t def) {
+  if (pos + 1 > end) {
+    return def;
+  }
+  return buf[pos++];
+}
+
+uint16_t RecordReader::u16(uint16_t def) {
+  if (pos + 2 > end) {
+    return def;
+  }
+  uint16_t v = buf[pos] | (buf[pos + 1] << 8);
+  pos += 2;
+  return v;
+}
+
+uint32_t RecordReader::u32(uint32_t def) {
+  if (pos + 4 > end) {
+    return def;
+  }
+  uint32_t v = (uint32_t)buf[pos] | ((uint32_t)buf[pos + 1] << 8) | ((uint32_t)buf[pos + 2] << 16) | ((uint32_t)buf[pos + 3] << 24);
+  pos += 4;
+  return v;
+}
+
+void RecordReader::bytes(void *data, size_t length) {
+  if (pos + length > end) {
+    return;
+  }
+  memcpy(data, buf + pos, length);
+  pos += length;
+}
+
+size_t RecordReader::enter_section() {
+  size_t outer_end = end;
+  size_t length = u8();
+
+  if (pos + length > outer_end) {
+    invalid = true;
+    length = outer_end - pos;
+  }
+  end = pos + length;
+
+  return outer_end;
+}
+
+void RecordReader::leave_section(size_t outer_end) {
+  // skip the fields written by newer firmware versions
+  pos = end;
+  end = outer_end;
+}
+
+} // namespace sprinkler_controller
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef _RECORD_H_
+#define _RECORD_H_
+
+#include <Arduino.h>
+
+namespace sprinkler_controller {
+
+uint16_t crc16(const uint8_t *data, size_t length);
+
+/**
+ * Serializes fields in little endian order into a fixed size buffer.
+ * Sections are prefixed with their length so that readers can skip fields
+ * they don't know about and default the ones that are missing.
+ **/
+struct RecordWriter {
+  uint8_t *buf;
+  size_t size;
+  size_t pos = 0;
+  bool overflow = false;
+
+  RecordWriter(uint8_t *buf, size_t size) : buf(buf), size(size) {}
+
+  void u8(uint8_t v);
+  void u16(uint16_t v);
+  void u32(uint32_t v);
+  void bytes(const void *data, size_t length);
+  size_t begin_section();
+  void end_section(size_t mark);
+};
+
+/**
+ * Reads fields written by RecordWriter. Reading past the end of the current
+ * section returns the provided default value.
+ **/
+struct RecordReader {
+  const uint8_t *buf;
+  size_t end;
+  size_t pos = 0;
+  bool invalid = false;
+
+  RecordReader(const uint8_t *buf, size_t size) : buf(buf), end(size) {}
+
+  uint8_t u8(uint8_t def = 0);
+  uint16_t u16(uint16_t def = 0);
+  uint32_t u32(uint32_t def = 0);
+  void bytes(void *data, size_t length);
+  size_t enter_section();
+  void leave_section(size_t outer_end);
+};
+
+} // namespace sprinkler_controller
+
+#endif
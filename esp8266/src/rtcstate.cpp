@@ -0,0 +1,57 @@
+#include "rtcstate.h"
+#include "eventlog.h"
+#include "record.h"
+
+namespace sprinkler_controller::rtcstate {
+
+static_assert(sizeof(WakeState) % 4 == 0, "RTC memory is accessed in 4 byte blocks");
+static_assert(RTC_WAKE_STATE_BLOCK * 4 + sizeof(WakeState) <= RTC_EVENTLOG_BLOCK * 4, "The wake state overlaps the event log");
+static_assert(sizeof(eventlog::Ring) % 4 == 0, "RTC memory is accessed in 4 byte blocks");
+static_assert(RTC_EVENTLOG_BLOCK * 4 + sizeof(eventlog::Ring) <= RTC_TELEMETRY_BLOCK * 4, "The event log overlaps the telemetry, lower EVENTLOG_SIZE");
+static_assert(sizeof(WifiCache) % 4 == 0, "RTC memory is accessed in 4 byte blocks");
+static_assert(RTC_WIFI_BLOCK * 4 + sizeof(WifiCache) <= 512, "The WiFi cache does not fit in RTC user memory");
+
+template <typename T>
+static uint16_t checksum(T &state) {
+  uint16_t crc = state.crc;
+  state.crc = 0;
+  uint16_t result = crc16(reinterpret_cast<const uint8_t *>(&state), sizeof(T));
+  state.crc = crc;
+  return result;
+}
+
+bool load(WakeState &state) {
+  if (!ESP.rtcUserMemoryRead(RTC_WAKE_STATE_BLOCK, reinterpret_cast<uint32_t *>(&state), sizeof(WakeState))) {
+    return false;
+  }
+
+  // RTC memory holds garbage after a power cycle
+  return state.crc == checksum(state);
+}
+
+void save(WakeState &state) {
+  state.crc = checksum(state);
+  ESP.rtcUserMemoryWrite(RTC_WAKE_STATE_BLOCK, reinterpret_cast<uint32_t *>(&state), sizeof(WakeState));
+}
+
+bool load(WifiCache &cache) {
+  if (!ESP.rtcUserMemoryRead(RTC_WIFI_BLOCK, reinterpret_cast<uint32_t *>(&cache), sizeof(WifiCache))) {
+    return false;
+  }
+
+  return cache.crc == checksum(cache);
+}
+
+void save(WifiCache &cache) {
+  cache.crc = checksum(cache);
+  ESP.rtcUserMemoryWrite(RTC_WIFI_BLOCK, reinterpret_cast<uint32_t *>(&cache), sizeof(WifiCache));
+}
+
+void clear() {
+  WakeState state;
+  memset(&state, 0, sizeof(WakeState));
+  state.resync = true;
+  save(state);
+}
+
+} // namespace sprinkler_controller::rtcstate
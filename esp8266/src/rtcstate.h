@@ -0,0 +1,63 @@
+#pragma once
+#ifndef _RTCSTATE_H_
+#define _RTCSTATE_H_
+
+#include <Arduino.h>
+
+// RTC user memory layout, in 4 byte blocks.
+// The first 32 blocks are overwritten by eboot during OTA updates.
+#define RTC_WAKE_STATE_BLOCK 32
+#define RTC_EVENTLOG_BLOCK 40
+#define RTC_TELEMETRY_BLOCK 90
+#define RTC_WIFI_BLOCK 114
+
+namespace sprinkler_controller::rtcstate {
+
+/**
+ * State kept in RTC user memory across deep sleep so that a wake can decide
+ * whether anything is due without bringing up WiFi and NTP
+ **/
+struct WakeState {
+  int8_t event_id;
+  uint8_t event_type;
+  bool rf_disabled;        // the current wake was started with the radio off
+  bool resync;             // the next wake must go online, see clear()
+  uint16_t crc;
+  uint16_t reserved2;
+  uint32_t event_time;     // next station event, epoch
+  uint32_t event_duration; // in seconds
+  uint32_t sync_epoch;     // NTP time when the controller last went to sleep from an online wake
+  uint32_t slept;          // seconds of deep sleep requested since sync_epoch
+  int32_t drift_ppm;       // deep sleep timer error, positive when the timer runs slow
+};
+
+/**
+ * Access point and IP lease of the last WiFi connection, so that the next
+ * wake can skip the scan (and DHCP with WIFI_CACHE_IP)
+ **/
+struct WifiCache {
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t reserved;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint16_t crc;
+  uint16_t reserved2;
+};
+
+bool load(WakeState &state);
+void save(WakeState &state);
+
+/**
+ * Replaces the wake state with an empty one that sends the next wake online
+ * with the radio on, e.g. when the clock isn't set or the state was lost
+ **/
+void clear();
+bool load(WifiCache &cache);
+void save(WifiCache &cache);
+
+} // namespace sprinkler_controller::rtcstate
+
+#endif
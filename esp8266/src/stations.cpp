@@ -1,30 +1,51 @@
 #include "stations.h"
 #include "ccronexpr/ccronexpr.h"
 #include "log.h"
-#include <EEPROM.h>
+#include "eventlog.h"
+#include "storage.h"
+#include "record.h"
+#include "topics.h"
+#include "telemetry.h"
+#include <limits.h>
 
 namespace sprinkler_controller {
 
-static uint8_t EEPROM_MARKER = 115;
+// Persisted state format. Bump the version when a field changes meaning;
+// appending fields to a section only needs the reader to default them.
+static const uint8_t STATE_VERSION = 2;
+static const size_t STATE_HEADER_SIZE = 4; // version, station count, crc16
+static const size_t STATE_STATION_SIZE = 1 + 4 + 1 + sizeof(cron_expr) + 8 + 2 + 4;
+static const size_t STATE_AGENDA_SECTION_ENTRIES = 40; // a section holds up to 255 bytes
+static const size_t STATE_AGENDA_SIZE = ((AGENDA_SIZE + STATE_AGENDA_SECTION_ENTRIES - 1) / STATE_AGENDA_SECTION_ENTRIES) + 4 + 1 + (6 * AGENDA_SIZE);
+static const size_t STATE_SIZE = STATE_HEADER_SIZE + (STATE_STATION_SIZE * NUM_STATIONS) + STATE_AGENDA_SIZE;
 
-static int EEPROM_SIZE = sizeof(EEPROM_MARKER) + sizeof(StationEvent) + (sizeof(Station) * NUM_STATIONS);
+static_assert(STATE_SIZE <= STORAGE_MAX_RECORD, "Station state does not fit in a storage record");
+static_assert(AGENDA_SIZE > 2 * NUM_STATIONS, "The agenda must hold the events of all stations at the same time");
 
-static uint64_t lastMillis = 0;
+// retained topics, station n config is bit n + 1
+static const uint64_t RETAINED_INTERFACE_MODE = 1;
+static const uint64_t RETAINED_ENABLED = 2;
 
-// topics to subscribe 
+// serialized state, shared by load() and commit() to keep the record off the stack
+static uint8_t s_state[STORAGE_MAX_RECORD];
+
+static const uint8_t STATION_FLAG_SCHEDULE = 1;
+static const uint8_t STATION_FLAG_ACTIVE = 2;
+
+// topics to subscribe. The order is load-bearing: brokers that send the retained messages in
+// subscription order deliver the station configs before the flags, and the retained drain in
+// init() relies on that for stations it doesn't know yet (see expected_retained()).
 const char *SUBS_TOPICS[2] = {"lawn-irrigation/+/config","lawn-irrigation/+/set"};
 
+// each L293D channel pair has its own enable pin, stations beyond the fourth share them
+static const uint8_t STATION_EN_PINS[] = {STATION_1_EN_PIN, STATION_2_EN_PIN, STATION_3_EN_PIN, STATION_4_EN_PIN};
+
 // forward decl
-static void enable_ics();
-static void disable_ics();
-static void set_stations_status(uint8_t status, uint8_t enable_pin);
 static void report_status(const Station &station);
-static time_t get_next_station_start(const char *cron, const time_t date);
-static uint8_t get_station_id(const char *topic);
-static int index_of(const char *str, const char *findstr);
-static bool starts_with(const char* start_str, const char* str);
-static void substr(const char s[], char sub[], int p, int l);
-static void substr(const char s[], char sub[], int p);
+static bool payload_equals(const char *payload, uint32_t length, const char *str);
+static bool payload_starts_with(const char *payload, uint32_t length, const char *str);
+static int payload_index_of(const char *payload, uint32_t length, char ch);
+static long payload_to_long(const char *payload, uint32_t length);
 
 void Station::start(time_t start, long dur = 0) {
   this->started = start;
@@ -35,8 +56,8 @@ void Station::start(time_t start, long dur = 0) {
     this->active_duration = this->config_duration;
   }
 
-  uint8_t mask = 1 << (2 * (this->id - 1));
-  set_stations_status(mask, enable_pin);
+  valves::Mask mask = (valves::Mask)1 << (2 * (this->id - 1));
+  valves::request(mask, enable_pin, pulse_ms);
 }
 
 void Station::stop() {
@@ -44,12 +65,18 @@ void Station::stop() {
   this->is_active = false;
   this->active_duration = 0;
 
-  uint8_t mask = 2 << (2 * (this->id - 1));
-  set_stations_status(mask, enable_pin);
+  valves::Mask mask = (valves::Mask)2 << (2 * (this->id - 1));
+  valves::request(mask, enable_pin, pulse_ms);
 }
 
 void Station::to_string(char* s) {
-  sprintf(s, "Station[%d] { enable_pin: %d, is_active: %d, started: %lld, duration[active]: %ld, duration[config]: %ld, cron: '%s' }\n", id, enable_pin, is_active, started, active_duration, config_duration, cron);
+  sprintf(s, "Station[%d] { enable_pin: %d, is_active: %d, started: %lld, duration[active]: %ld, duration[config]: %ld, pulse: %u, scheduled: %d }\n", id, enable_pin, is_active, started, active_duration, config_duration, pulse_ms, has_schedule);
+}
+
+StationController::StationController() {
+  for (int i = 0; i < NUM_STATIONS; i++) {
+    m_stations[i] = {i + 1, STATION_EN_PINS[i % 4], 0, VALVE_PULSE_MS, {}, false, 0, false, 0, 0};
+  }
 }
 
 void StationController::init(NTPClient *time_client) {
@@ -57,7 +84,10 @@ void StationController::init(NTPClient *time_client) {
 
   m_time_client = time_client;
 
-  EEPROM.begin(EEPROM_SIZE);
+  // NTP, MQTT and the retained drain below block, and the ICs are switched off
+  valves::wait_idle();
+
+  storage::begin();
 
   digitalWrite(ENABLE_ICS_PIN, LOW);
   pinMode(ENABLE_ICS_PIN, OUTPUT);
@@ -66,44 +96,81 @@ void StationController::init(NTPClient *time_client) {
 
   int retries = 5;
   while(!m_time_client->forceUpdate() && retries-- > 0);
+  telemetry::count(telemetry::NTP_RETRIES, 5 - retries);
+  telemetry::mark(telemetry::NTP);
+
+  m_retained_seen = 0;
 
   mqttcli::init([this](char *topic, byte *payload, uint32_t length) {
       debug_printf("MQTT Message arrived [%s]\n", topic);
-  
-      char payload_str[length + 1];
-      memcpy(payload_str, payload, length);
-      payload_str[length] = '\0';
-  
-      if (starts_with("lawn-irrigation/interface-mode/set", topic))  {
-        process_topic_mode_set(payload_str, length); // retained message
-      } else if (starts_with("lawn-irrigation/enabled/set", topic))  {
-        process_topic_enabled_set(payload_str, length); // retained message
-      } else if (starts_with("lawn-irrigation/station", topic))  {
-        Station *station = get_station_from_topic(topic);
-        if (station != NULL) {
-          if (m_interface_mode && index_of(topic, "set") > 0) {
+
+      // the payload points into the PubSubClient buffer and isn't NUL terminated,
+      // handlers only read 'length' bytes of it
+      const char *payload_str = (const char *)payload;
+
+      topics::Route route = topics::match(topic);
+      Station *station = get_station(route.station);
+
+      switch (route.id) {
+        case topics::INTERFACE_MODE_SET:
+          m_retained_seen |= RETAINED_INTERFACE_MODE;
+          process_topic_mode_set(payload_str, length); // retained message
+          break;
+        case topics::ENABLED_SET:
+          m_retained_seen |= RETAINED_ENABLED;
+          process_topic_enabled_set(payload_str, length); // retained message
+          break;
+        case topics::STATION_SET:
+          if (station != NULL && m_interface_mode) {
             process_topic_station_set(*station, payload_str, length);
-          } else if (m_interface_mode && index_of(topic, "state") > 0) {
+          }
+          break;
+        case topics::STATION_STATE:
+          if (station != NULL && m_interface_mode) {
             process_topic_station_state(*station);
-          } else if (index_of(topic, "config") > 0) {
+          }
+          break;
+        case topics::STATION_CONFIG:
+          if (station != NULL) {
+            m_retained_seen |= (uint64_t)1 << (station->id + 1);
             process_topic_station_config(*station, payload_str, length); // retained message
           }
-        }
+          break;
+        default:
+          break;
       }
     },
     SUBS_TOPICS, 
    2
   );
+  telemetry::mark(telemetry::MQTT);
+
+  // receive and process retained messages, until all the expected ones are in. Without configured
+  // stations no config is expected, so the drain also waits for new topics to stop arriving.
+  uint64_t expected = expected_retained();
+  bool wait_quiet = expected == (RETAINED_INTERFACE_MODE | RETAINED_ENABLED);
+  uint64_t seen = 0;
+  unsigned long drain_started = millis();
+  unsigned long last_new = drain_started;
+  while (millis() - drain_started < RETAINED_DRAIN_MS) {
+    if (m_retained_seen != seen) {
+      seen = m_retained_seen;
+      last_new = millis();
+    }
+    if ((seen & expected) == expected && (!wait_quiet || millis() - last_new >= RETAINED_QUIET_MS)) {
+      break;
+    }
 
-  // receive and process retained messages
-  int loop_idx = 10;
-  while (loop_idx-- > 0) {
     mqttcli::loop();
-    delay(100);
+    delay(10);
   }
+  telemetry::mark(telemetry::DRAIN);
 
   time_t now = m_time_client->getEpochTime();
-  report_log("### Started at: '%lld'. Epoch Time Retries: '%d' ###\n", now, 5 - retries);
+  eventlog::add(eventlog::STARTED, now, 5 - retries);
+
+  // one write for the whole retained burst
+  commit();
 
   print_state();
 
@@ -111,29 +178,43 @@ void StationController::init(NTPClient *time_client) {
 }
 
 void StationController::loop() {
-  m_time_client->update();
+  // an NTP update may block on the network, so it waits until no valve is being pulsed
+  valves::loop();
+  if (!valves::busy()) {
+    m_time_client->update();
+  }
   mqttcli::loop();
 
-  // process station events every 30 seconds
-  if (millis() - lastMillis >= 30*1000UL) {
-      lastMillis = millis();
+  time_t now = m_time_client->getEpochTime();
+  check_clock_jump(now);
+
+  // station events are only processed when the next one is due or the schedule changed
+  if (m_schedule_changed || (m_next_deadline != 0 && now >= m_next_deadline)) {
+    m_schedule_changed = false;
+
+    process_station_event();
+    StationEvent ev = next_station_event();
 
-      process_station_event();
-      next_station_event();
+    // without upcoming events the agenda is checked again once its horizon has passed
+    m_next_deadline = ev.type == EventType::NOOP ? now + AGENDA_HORIZON : ev.time;
   }
+
+  commit();
+
+  // whatever was logged during this pass goes out as one message
+  eventlog::flush();
 }
 
 void StationController::set_interface_mode(bool mode) {
   m_interface_mode = mode;
 
   save();
+  commit();
 
   report_interface_mode_state();
 }
 
-// TOPIC format: lawn-irrigation/station#/set
-Station *StationController::get_station_from_topic(const char* topic) {
-  uint8_t station_id = get_station_id(topic);
+Station *StationController::get_station(uint16_t station_id) {
   if (station_id > 0 && station_id <= NUM_STATIONS) {
     return &(m_stations[station_id - 1]);
   }
@@ -146,10 +227,11 @@ void StationController::check_stop_stations(bool force) {
     Station &station = this->m_stations[i];
     time_t now = m_time_client->getEpochTime();
     if (station.is_active == true) {
-      if (force || ((now - station.started) > station.active_duration)) {
-        report_log("[%lld] Stopping station %d. Started = %lld, Duration[active] = %ld, Elapsed = %lld, Forced = %d", now, station.id, station.started, station.active_duration, now - station.started, force);
+      if (force || ((now - station.started) >= station.active_duration)) {
+        eventlog::add(eventlog::STATION_STOP, now, station.id, force, now - station.started, station.active_duration);
         
         station.stop();
+        save();
 
         report_status(station);
       }
@@ -158,79 +240,229 @@ void StationController::check_stop_stations(bool force) {
 }
 
 StationEvent StationController::next_station_event() {
+  time_t now = m_time_client->getEpochTime();
+
+  check_clock_jump(now);
+
+  // the agenda is only rebuilt when the schedule or the clock changed, or once it has been used up
+  if (m_agenda_stale || m_agenda_len == 0) {
+    rebuild_agenda(now);
+  }
+
   StationEvent next_event;
+  if (m_agenda_len > 0) {
+    next_event = agenda_event(m_agenda[0]);
+  }
+
+  commit();
+
+  char msg[100];
+  next_event.to_string(msg);
+  debug_printf("Next Station Event: %s\n", msg);
+
+  return next_event;
+}
+
+void StationController::rebuild_agenda(time_t now) {
+  // events up to the last one taken from the agenda were already processed, the ones
+  // that were due less than EVENT_WINDOW ago still run
+  time_t from = m_agenda_consumed > now - EVENT_WINDOW ? m_agenda_consumed : now - EVENT_WINDOW;
+  time_t dropped = 0;
+
+  save();
+
+  m_agenda_len = 0;
+  m_agenda_stale = false;
 
   for (int i = 0; i < NUM_STATIONS; i++) {
     Station &station = m_stations[i];
+    time_t start_from = from;
 
     if (station.is_active == true) {
-      time_t t = station.started + station.active_duration;
-      if (next_event.time == 0 || next_event.time > t) {
-        next_event.id = station.id;
-        next_event.time = t;
-        next_event.type = EventType::STOP;
-      }
-    } else {
-      if (strlen(station.cron) > 0) {
-        time_t t = get_next_station_start(station.cron, m_time_client->getEpochTime());
-        if (next_event.time == 0 || next_event.time > t) {
-          next_event.id = station.id;
-          next_event.time = t;
-          next_event.duration = station.config_duration;
-          next_event.type = EventType::START;
-        }
+      time_t stop = station.started + station.active_duration;
+      agenda_insert({(uint32_t)stop, (uint8_t)station.id, EventType::STOP}, dropped);
+
+      // a running station can't start again before it stops
+      if (stop > start_from) {
+        start_from = stop;
       }
     }
+
+    if (!station.has_schedule) {
+      continue;
+    }
+
+    time_t starts[AGENDA_STATION_STARTS];
+    size_t count = cron_next_n(&station.schedule, start_from, starts, AGENDA_STATION_STARTS);
+    long duration = station.config_duration > MAX_DURATION ? MAX_DURATION : station.config_duration;
+
+    for (size_t k = 0; k < count && starts[k] <= from + AGENDA_HORIZON; k++) {
+      agenda_insert({(uint32_t)starts[k], (uint8_t)station.id, EventType::START}, dropped);
+      agenda_insert({(uint32_t)(starts[k] + duration), (uint8_t)station.id, EventType::STOP}, dropped);
+    }
+
+    // the starts that weren't computed count as dropped
+    if (count == AGENDA_STATION_STARTS && (dropped == 0 || starts[count - 1] + 1 < dropped)) {
+      dropped = starts[count - 1] + 1;
+    }
+  }
+
+  // entries at the time of the first dropped one go as well, the next rebuild picks all of them up
+  if (dropped != 0) {
+    while (m_agenda_len > 0 && m_agenda[m_agenda_len - 1].time >= dropped) {
+      m_agenda_len--;
+    }
+  }
+
+  debug_printf("Agenda rebuilt from %lld: %d events\n", from, m_agenda_len);
+}
+
+// Inserts the entry in time order, STOP before START at the same time. When the agenda
+// is full the latest entry is dropped and 'dropped' keeps the earliest time lost so far.
+void StationController::agenda_insert(const AgendaEntry &entry, time_t &dropped) {
+  auto before = [](const AgendaEntry &a, const AgendaEntry &b) {
+    return a.time < b.time || (a.time == b.time && a.type == EventType::STOP && b.type != EventType::STOP);
+  };
+
+  if (m_agenda_len == AGENDA_SIZE) {
+    const AgendaEntry &latest = before(entry, m_agenda[AGENDA_SIZE - 1]) ? m_agenda[AGENDA_SIZE - 1] : entry;
+    if (dropped == 0 || (time_t)latest.time < dropped) {
+      dropped = latest.time;
+    }
+    if (&latest == &entry) {
+      return;
+    }
+    m_agenda_len--;
+  }
+
+  int pos = m_agenda_len;
+  while (pos > 0 && before(entry, m_agenda[pos - 1])) {
+    m_agenda[pos] = m_agenda[pos - 1];
+    pos--;
+  }
+  m_agenda[pos] = entry;
+  m_agenda_len++;
+}
+
+// The STOP queued with a START assumes the station starts on time. Once it has started,
+// the STOP moves to its actual end so that it isn't due before the run has elapsed.
+void StationController::agenda_reschedule_stop(const Station &station) {
+  for (int i = 0; i < m_agenda_len; i++) {
+    if (m_agenda[i].type == EventType::STOP && m_agenda[i].id == station.id) {
+      m_agenda_len--;
+      memmove(m_agenda + i, m_agenda + i + 1, (m_agenda_len - i) * sizeof(AgendaEntry));
+      break;
+    }
+  }
+
+  time_t dropped = 0;
+  agenda_insert({(uint32_t)(station.started + station.active_duration), (uint8_t)station.id, EventType::STOP}, dropped);
+  if (dropped != 0) {
+    m_agenda_stale = true;
+  }
+}
+
+void StationController::agenda_pop() {
+  // STOP events are only deadlines, check_stop_stations() does the work
+  if (m_agenda[0].type == EventType::START && m_agenda[0].time > m_agenda_consumed) {
+    m_agenda_consumed = m_agenda[0].time;
   }
 
-  m_station_event = next_event;
+  m_agenda_len--;
+  memmove(m_agenda, m_agenda + 1, m_agenda_len * sizeof(AgendaEntry));
 
   save();
+}
 
-  char msg[100];
-  next_event.to_string(msg);
-  debug_printf("Next Station Event: %s\n", msg);
+StationEvent StationController::agenda_event(const AgendaEntry &entry) {
+  StationEvent ev;
+  ev.id = entry.id;
+  ev.time = entry.time;
+  ev.type = (EventType)entry.type;
+  if (ev.type == EventType::START) {
+    ev.duration = m_stations[entry.id - 1].config_duration;
+  }
+  return ev;
+}
 
-  return next_event;
+void StationController::check_clock_jump(time_t now) {
+  unsigned long ms = millis();
+
+  if (m_last_epoch != 0) {
+    time_t expected = m_last_epoch + (time_t)((ms - m_last_epoch_millis) / 1000);
+    time_t drift = now > expected ? now - expected : expected - now;
+    if (drift > CLOCK_JUMP_THRESHOLD) {
+      debug_printf("Clock adjusted by %lld seconds. Recomputing schedules...\n", now - expected);
+      // events taken before a backward jump stay consumed so they don't run twice; a forward
+      // jump past them consumes what it skipped, except what is still within EVENT_WINDOW
+      if (now > expected && now - EVENT_WINDOW > m_agenda_consumed) {
+        m_agenda_consumed = now - EVENT_WINDOW;
+        save();
+      }
+      invalidate_schedules();
+    }
+  }
+
+  m_last_epoch = now;
+  m_last_epoch_millis = ms;
+}
+
+void StationController::invalidate_schedules() {
+  m_agenda_stale = true;
+  m_schedule_changed = true;
 }
 
 void StationController::process_station_event() {
   check_stop_stations();
-  
-  if (m_station_event.id == -1)
-    return;
 
-  if (m_station_event.type == START) {
-      time_t now = m_time_client->getEpochTime();
-      if (now > m_station_event.time + 30) {
-        report_log("[%lld] Scheduled START event out-of-sync with the system time...\nScheduled: '%lld' vs Now: '%lld' \nSkipping event!", now, m_station_event.time, now);
-      } else if (now < (m_station_event.time - 30)) {
-        if (!m_interface_mode) {
-          report_log("[%lld] Nothing to do yet...!", now);
-        }
-      } else {
-        if (m_enabled) {
-            check_stop_stations(true); // if we are starting a station, all other stations must be stopped
-
-            Station &st = m_stations[m_station_event.id - 1];
-            
-            report_log("[%lld] Starting station %d. Duration = %ld", now, st.id, m_station_event.duration);
-            
-            st.start(now, m_station_event.duration);
-            report_status(st);
-            
-            save();
-        } else {
-          report_log("[%lld] Skipping station START event since irrigation is disabled.", now);
-        }
+  time_t now = m_time_client->getEpochTime();
+
+  while (m_agenda_len > 0) {
+    const AgendaEntry &entry = m_agenda[0];
+
+    if (entry.type == EventType::STOP) {
+      if ((time_t)entry.time > now) {
+        break;
       }
+      agenda_pop();
+      continue;
     }
+
+    if (now < (time_t)entry.time - EVENT_WINDOW) {
+      if (!m_interface_mode) {
+        eventlog::add(eventlog::NOTHING_DUE, now);
+      }
+      break;
+    }
+
+    StationEvent ev = agenda_event(entry);
+    agenda_pop();
+
+    if (now > ev.time + EVENT_WINDOW) {
+      eventlog::add(eventlog::START_OUT_OF_SYNC, now, ev.id, 0, ev.time);
+    } else if (m_enabled) {
+      check_stop_stations(true); // if we are starting a station, all other stations must be stopped
+
+      Station &st = m_stations[ev.id - 1];
+
+      eventlog::add(eventlog::STATION_START, now, st.id, 0, ev.duration);
+
+      st.start(now, ev.duration);
+      agenda_reschedule_stop(st);
+      report_status(st);
+
+      save();
+    } else {
+      eventlog::add(eventlog::START_DISABLED, now, ev.id);
+    }
+  }
 }
 
 void StationController::process_topic_enabled_set(const char* payload_str, uint32_t length) {
   debug_printf("Processing topic 'lawn-irrigation/enabled/set'...\n");
 
-  m_enabled = strcmp(payload_str, "on") == 0;
+  m_enabled = payload_equals(payload_str, length, "on");
+  m_schedule_changed = true;
 
   debug_printf("Topic 'lawn-irrigation/enabled/set' done.\n");
 }
@@ -239,19 +471,22 @@ void StationController::process_topic_station_set(Station &station, const char*
   debug_printf("Processing topic 'lawn-irrigation/station/set'...\n");
 
   // get op and duration
-  if (starts_with("on", payload_str)) {
+  if (payload_starts_with(payload_str, length, "on")) {
     check_stop_stations(true); // if we are starting a station, all other stations must be stopped
-    char dur[20] = {0};
-    substr(payload_str, dur, index_of(payload_str, "|") + 1);
-    
-    station.start(m_time_client->getEpochTime(), atoi(dur));
+    int sep_index = payload_index_of(payload_str, length, '|');
+    long dur = sep_index >= 0 ? payload_to_long(payload_str + sep_index + 1, length - sep_index - 1) : 0;
+
+    station.start(m_time_client->getEpochTime(), dur);
     report_status(station);
 
-  } else if (starts_with("off", payload_str)) {
+  } else if (payload_starts_with(payload_str, length, "off")) {
     station.stop();
     report_status(station);
   }
 
+  m_agenda_stale = true;
+  m_schedule_changed = true;
+
   save();
 
   debug_printf("Topic 'lawn-irrigation/station/set' done.\n");
@@ -265,13 +500,15 @@ void StationController::process_topic_station_state(Station &station) {
   debug_printf("Topic 'lawn-irrigation/station/state' done.\n");
 }
 
-void StationController::process_topic_mode_set(const char* payload_str, uint16_t length) {
+void StationController::process_topic_mode_set(const char* payload_str, uint32_t length) {
   debug_printf("Processing topic 'lawn-irrigation/interface-mode/set'...\n");
   
-  // get mode
-  m_interface_mode = strncmp("on", payload_str, 2) == 0;
-
-  save();
+  // get mode, the retained message comes again on every connect
+  bool interface_mode = payload_starts_with(payload_str, length, "on");
+  if (interface_mode != m_interface_mode) {
+    m_interface_mode = interface_mode;
+    save();
+  }
 
   report_interface_mode_state();
 
@@ -281,15 +518,56 @@ void StationController::process_topic_mode_set(const char* payload_str, uint16_t
 void StationController::process_topic_station_config(Station &station, const char* payload_str, uint32_t length) {
   debug_printf("Processing topic 'lawn-irrigation/station/config'...\n");
 
-  // get mode
-  int sep_index = index_of(payload_str, "|");
+  // the broker redelivers the retained config on every connect, only a new payload is applied
+  uint32_t fingerprint = (length << 16) | crc16((const uint8_t *)payload_str, length);
+  if (fingerprint == station.config_fingerprint) {
+    debug_printf("Config of station %d is unchanged.\n", station.id);
+    return;
+  }
+
+  // payload format: cron|duration[|pulse_ms]
+  int sep_index = payload_index_of(payload_str, length, '|');
+
+  char cron[40] = {0};
+  if (sep_index >= (int)sizeof(cron)) {
+    eventlog::add(eventlog::CRON_TOO_LONG, m_time_client->getEpochTime(), station.id);
+    return;
+  }
 
-  substr(payload_str, station.cron, 0, sep_index);
-  char dur[10] = {0};
-  substr(payload_str, dur, sep_index + 1);
+  if (sep_index > 0) {
+    memcpy(cron, payload_str, sep_index); // cron_parse_expr() needs a terminated copy
+  }
+  const char *dur = payload_str + sep_index + 1;
+  uint32_t dur_length = length - sep_index - 1;
+
+  station.config_duration = payload_to_long(dur, dur_length);
 
-  station.config_duration = atoi(dur);
+  // optional solenoid pulse width
+  int pulse_index = payload_index_of(dur, dur_length, '|');
+  station.pulse_ms = VALVE_PULSE_MS;
+  if (pulse_index >= 0) {
+    long pulse_ms = payload_to_long(dur + pulse_index + 1, dur_length - pulse_index - 1);
+    station.pulse_ms = pulse_ms < VALVE_MIN_PULSE_MS ? VALVE_MIN_PULSE_MS : (pulse_ms > VALVE_MAX_PULSE_MS ? VALVE_MAX_PULSE_MS : pulse_ms);
+  }
 
+  // compile the schedule once here so that the event loop only needs cron_next()
+  station.has_schedule = false;
+  m_agenda_stale = true;
+  m_schedule_changed = true;
+  if (strlen(cron) > 0) {
+    const char *err = NULL;
+    cron_parse_expr(cron, &station.schedule, &err);
+
+    if (err != NULL) {
+      debug_printf("Error while parsing the CRON expr '%s' for station %d - %s\n", cron, station.id, err);
+      eventlog::add(eventlog::CRON_INVALID, m_time_client->getEpochTime(), station.id);
+    } else {
+      station.has_schedule = true;
+    }
+  }
+
+  // only an applied payload counts as seen, a rejected one is checked again on redelivery
+  station.config_fingerprint = fingerprint;
   save();
 
   debug_printf("Topic 'lawn-irrigation/station/config' done.\n");
@@ -299,139 +577,182 @@ void StationController::report_interface_mode_state() {
   mqttcli::publish("lawn-irrigation/interface-mode/state", m_interface_mode ? "on" : "off", false);
 }
 
-void StationController::load() {
-  int addr = 0;
-
-  if (EEPROM.read(addr) == EEPROM_MARKER) {
-    debug_printf("Loading state from EEPROM...");
-
-    addr += 1;
-
-    EEPROM.get(addr, m_station_event);
-    addr += sizeof(m_station_event);
-
-    for (int i = 0; i < NUM_STATIONS; i++) {
-      EEPROM.get(addr, m_stations[i]);
-      addr += sizeof(Station);
+// The mode and enabled flags, and the config of the stations configured before. MQTT doesn't order
+// messages across subscriptions, so a station configured since then may still arrive after these.
+uint64_t StationController::expected_retained() {
+  uint64_t expected = RETAINED_INTERFACE_MODE | RETAINED_ENABLED;
+  for (int i = 0; i < NUM_STATIONS; i++) {
+    if (m_stations[i].has_schedule || m_stations[i].config_duration > 0) {
+      expected |= (uint64_t)1 << (m_stations[i].id + 1);
     }
-
-    debug_printf("done.\n");
   }
+  return expected;
 }
 
-void StationController::save() {
-  debug_printf("Saving state to EEPROM...");
-
-  int addr = 0;
-  EEPROM.write(addr, EEPROM_MARKER);
-  addr += 1;
-
-  EEPROM.put(addr, m_station_event);
-  addr += sizeof(m_station_event);
+// Latching valves keep their position without power. Without a saved state nothing tells
+// which ones are open, e.g. after a lost record or an update from the firmware that kept the
+// state in EEPROM (its image isn't read), so all of them are closed.
+void StationController::close_all_stations() {
+  debug_printf("No saved state. Closing all stations.\n");
 
   for (int i = 0; i < NUM_STATIONS; i++) {
-    EEPROM.put(addr, m_stations[i]);
-    addr += sizeof(Station);
+    m_stations[i].stop();
   }
+}
 
-  EEPROM.commit();
+void StationController::load() {
+  size_t length = storage::read(s_state, sizeof(s_state));
 
-  debug_printf("done.\n");
-}
+  if (length < STATE_HEADER_SIZE) {
+    close_all_stations();
+    return;
+  }
 
-void StationController::print_state() {
-  debug_printf("\n################################\nSystem is %s\nInterface mode = %s\n\n", m_enabled ? "ENABLED": "DISABLED", m_interface_mode ? "ON": "OFF");
-  char msg[200];
-  m_station_event.to_string(msg);
-  debug_printf(msg);
-  for (int i=0; i < NUM_STATIONS; i++) {
-    char s[200];
-    m_stations[i].to_string(s);
-    debug_printf(s);
+  // records written by other firmware versions may be shorter or longer than STATE_SIZE
+  RecordReader r(s_state, length);
+  uint8_t version = r.u8();
+  uint8_t station_count = r.u8();
+  uint16_t crc = r.u16();
+
+  if (version == 0 || crc != crc16(s_state + STATE_HEADER_SIZE, length - STATE_HEADER_SIZE)) {
+    eventlog::add(eventlog::STATE_DISCARDED, m_time_client->getEpochTime(), version, crc);
+    close_all_stations();
+    return;
   }
-  debug_printf("################################\n");
-}
 
-static void set_shift_register(uint8_t value) {
-  shiftOut(SR_SERIAL_INPUT, SR_CLK, LSBFIRST, value);
+  debug_printf("Loading state from flash (version %d)...", version);
 
-  digitalWrite(SR_STORAGE_CLK, LOW);
-  digitalWrite(SR_STORAGE_CLK, HIGH);
-  digitalWrite(SR_STORAGE_CLK, LOW);
-}
+  size_t outer;
+  if (version < 2) {
+    // version 1 kept a single next event ahead of the stations, the agenda is rebuilt instead
+    outer = r.enter_section();
+    r.leave_section(outer);
+  }
 
-static void enable_ics() {
-  // TODO: check which pin we can use to control the ICS
-  //       https://randomnerdtutorials.com/esp8266-pinout-reference-gpios/
+  for (int i = 0; i < station_count && i < NUM_STATIONS; i++) {
+    Station &station = m_stations[i];
 
-  // setup
-  // use RX pin as GPIO
-  pinMode(SR_SERIAL_INPUT, FUNCTION_3);
-  pinMode(SR_SERIAL_INPUT, OUTPUT);
+    outer = r.enter_section();
+    station.config_duration = r.u32();
+    uint8_t flags = r.u8();
+    r.bytes(&station.schedule, sizeof(cron_expr));
+    station.started = r.u32();
+    station.active_duration = r.u32();
+    if (version < 2) {
+      r.u32(); // cached next start of version 1
+    }
+    station.pulse_ms = r.u16(VALVE_PULSE_MS);
+    station.config_fingerprint = r.u32(0);
+    r.leave_section(outer);
 
-  digitalWrite(STATION_1_EN_PIN, LOW);
-  pinMode(STATION_1_EN_PIN, OUTPUT);
-  digitalWrite(STATION_2_EN_PIN, LOW);
-  pinMode(STATION_2_EN_PIN, OUTPUT);
-  digitalWrite(STATION_3_EN_PIN, LOW);
-  pinMode(STATION_3_EN_PIN, OUTPUT);
+    station.has_schedule = flags & STATION_FLAG_SCHEDULE;
+    station.is_active = flags & STATION_FLAG_ACTIVE;
+  }
 
-  digitalWrite(SR_OUTPUT_ENABLED, HIGH);
-  pinMode(SR_OUTPUT_ENABLED, OUTPUT);
+  // records of builds with more stations, the agenda follows their sections
+  for (int i = NUM_STATIONS; i < station_count; i++) {
+    outer = r.enter_section();
+    r.leave_section(outer);
+  }
 
-  digitalWrite(SR_CLK, LOW);
-  pinMode(SR_CLK, OUTPUT);
+  m_agenda_len = 0;
+  if (version >= 2) {
+    outer = r.enter_section();
+    m_agenda_consumed = r.u32();
+    uint8_t length = r.u8();
+    for (int i = 0; i < length && i < AGENDA_SIZE; i++) {
+      if (i > 0 && i % STATE_AGENDA_SECTION_ENTRIES == 0) {
+        r.leave_section(outer);
+        outer = r.enter_section();
+      }
 
-  digitalWrite(SR_STORAGE_CLK, LOW);
-  pinMode(SR_STORAGE_CLK, OUTPUT);
+      AgendaEntry &entry = m_agenda[m_agenda_len];
+      entry.time = r.u32();
+      entry.id = r.u8();
+      entry.type = r.u8(NOOP);
+      // entries for stations this firmware doesn't have, or of unknown types, are dropped
+      if (entry.id > 0 && entry.id <= NUM_STATIONS && (entry.type == START || entry.type == STOP)) {
+        m_agenda_len++;
+      }
+    }
+    r.leave_section(outer);
+  }
 
-  // enable
-  digitalWrite(ENABLE_ICS_PIN, HIGH);
+  debug_printf("done.\n");
 }
 
-static void disable_ics() {
-  //disable
-  digitalWrite(ENABLE_ICS_PIN, LOW);
-
-  // revert from GPIO to RX 
-  pinMode(SR_SERIAL_INPUT, FUNCTION_0);
-  pinMode(SR_SERIAL_INPUT, INPUT);
-  
-  // float pins
-  pinMode(STATION_1_EN_PIN, INPUT);
-  pinMode(STATION_2_EN_PIN, INPUT);
-  pinMode(STATION_3_EN_PIN, INPUT);
-  pinMode(SR_OUTPUT_ENABLED, INPUT);
-  pinMode(SR_CLK, INPUT);
-  pinMode(SR_STORAGE_CLK, INPUT);
+// Marks the state as changed. The flash is only written by commit(), so that a burst
+// of changes (e.g. the retained messages after connecting) costs a single write.
+void StationController::save() {
+  m_save_pending = true;
 }
 
-static void set_stations_status(uint8_t status, uint8_t enable_pin) {
-  enable_ics();
+void StationController::commit() {
+  if (!m_save_pending) {
+    return;
+  }
+  m_save_pending = false;
+
+  memset(s_state, 0, STATE_SIZE);
+  RecordWriter w(s_state, STATE_SIZE);
 
-  set_shift_register(status);
+  w.u8(STATE_VERSION);
+  w.u8(NUM_STATIONS);
+  w.u16(0); // crc, filled in below
 
-  digitalWrite(SR_OUTPUT_ENABLED, LOW);
-  delay(50);
-  digitalWrite(enable_pin, HIGH);
-  delay(1000);
-  digitalWrite(enable_pin, LOW);
+  for (int i = 0; i < NUM_STATIONS; i++) {
+    const Station &station = m_stations[i];
+
+    size_t mark = w.begin_section();
+    w.u32(station.config_duration);
+    w.u8((station.has_schedule ? STATION_FLAG_SCHEDULE : 0) | (station.is_active ? STATION_FLAG_ACTIVE : 0));
+    w.bytes(&station.schedule, sizeof(cron_expr));
+    w.u32(station.started);
+    w.u32(station.active_duration);
+    w.u16(station.pulse_ms);
+    w.u32(station.config_fingerprint);
+    w.end_section(mark);
+  }
 
-  digitalWrite(SR_OUTPUT_ENABLED, HIGH);
+  size_t mark = w.begin_section();
+  w.u32(m_agenda_consumed);
+  w.u8(m_agenda_len);
+  for (int i = 0; i < m_agenda_len; i++) {
+    // long agendas continue in the sections that follow
+    if (i > 0 && i % STATE_AGENDA_SECTION_ENTRIES == 0) {
+      w.end_section(mark);
+      mark = w.begin_section();
+    }
 
-  disable_ics();
-}
+    w.u32(m_agenda[i].time);
+    w.u8(m_agenda[i].id);
+    w.u8(m_agenda[i].type);
+  }
+  w.end_section(mark);
 
-static time_t get_next_station_start(const char *cron, time_t date) {
-  cron_expr ce;
-  const char *err = NULL;
-  cron_parse_expr(cron, &ce, &err);
+  uint16_t crc = crc16(s_state + STATE_HEADER_SIZE, STATE_SIZE - STATE_HEADER_SIZE);
+  s_state[2] = crc & 0xFF;
+  s_state[3] = crc >> 8;
 
-  if (err != NULL) {
-    debug_printf("Error while parsing the CRON expr - %s\n", err);
+  // the storage layer skips the flash write when nothing changed since the last save
+  if (w.overflow || !storage::write(s_state, STATE_SIZE)) {
+    debug_printf("Failed to save state to flash!\n");
   }
+}
 
-  return cron_next(&ce, date);
+void StationController::print_state() {
+  debug_printf("\n################################\nSystem is %s\nInterface mode = %s\n\n", m_enabled ? "ENABLED": "DISABLED", m_interface_mode ? "ON": "OFF");
+  char msg[200];
+  for (int i = 0; i < m_agenda_len; i++) {
+    agenda_event(m_agenda[i]).to_string(msg);
+    debug_printf(msg);
+  }
+  for (int i=0; i < NUM_STATIONS; i++) {
+    char s[200];
+    m_stations[i].to_string(s);
+    debug_printf(s);
+  }
+  debug_printf("################################\n");
 }
 
 static void report_status(const Station &station) {
@@ -440,48 +761,45 @@ static void report_status(const Station &station) {
   mqttcli::publish(buf, station.is_active ? "on" : "off", false);
 }
 
-// assuming that the station ID is a single digit
-static uint8_t get_station_id(const char *topic) {
-  char *found = strstr(topic, "/station");
-  char *pos = found ? found + 8 : NULL;
-  if (pos != NULL) {
-    return (*pos) - '0';
-  }
-
-  return 0;
+static bool payload_equals(const char *payload, uint32_t length, const char *str) {
+  size_t str_length = strlen(str);
+  return length == str_length && memcmp(payload, str, str_length) == 0;
 }
 
-static int index_of(const char *str, const char *findstr) {
-  char *pos = strstr(str, findstr);
-  return pos ? pos - str : -1;
+static bool payload_starts_with(const char *payload, uint32_t length, const char *str) {
+  size_t str_length = strlen(str);
+  return length >= str_length && memcmp(payload, str, str_length) == 0;
 }
 
-static bool starts_with(const char* start_str, const char* str) {
-  return strncmp(start_str, str, strlen(start_str)) == 0;
+static int payload_index_of(const char *payload, uint32_t length, char ch) {
+  const char *pos = (const char *)memchr(payload, ch, length);
+  return pos ? pos - payload : -1;
 }
 
-static void substr(const char s[], char sub[], int p, int l) {
-   int c = 0;
-   
-   while (c < l) {
-      sub[c] = s[p + c];
-      c++;
-   }
-   sub[c] = '\0';
-}
+// atol() over a payload that isn't NUL terminated, saturating instead of overflowing
+static long payload_to_long(const char *payload, uint32_t length) {
+  uint32_t i = 0;
+  while (i < length && isspace((unsigned char)payload[i])) {
+    i++;
+  }
 
-static void substr(const char s[], char sub[], int p) {
-   int c = 0;
-   
-   char ch;
+  bool negative = false;
+  if (i < length && (payload[i] == '-' || payload[i] == '+')) {
+    negative = payload[i] == '-';
+    i++;
+  }
 
-   do {
-    ch = s[p + c];
-    sub[c] = ch;
-    c++;
-   } while (ch != '\0');
+  long value = 0;
+  for (; i < length && isdigit((unsigned char)payload[i]); i++) {
+    int digit = payload[i] - '0';
+    if (value > (LONG_MAX - digit) / 10) {
+      value = LONG_MAX;
+      break;
+    }
+    value = value * 10 + digit;
+  }
 
-   sub[c] = '\0';
+  return negative ? -value : value;
 }
 
 } // namespace sprinkler_controller
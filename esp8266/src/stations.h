@@ -5,21 +5,19 @@
 #include <arduino.h>
 #include <NTPClient.h>
 #include "mqttcli.h"
-
-#define NUM_STATIONS 4
+#include "ccronexpr/ccronexpr.h"
+#include "valves.h"
 
 #define MAX_DURATION 1800L // 30 minutes
 
-#define STATION_1_EN_PIN 14
-#define STATION_2_EN_PIN 12
-#define STATION_3_EN_PIN 13
-#define STATION_4_EN_PIN 15
+#define CLOCK_JUMP_THRESHOLD 5 // seconds of drift before cached schedules are recomputed
+#define EVENT_WINDOW 30 // seconds, tolerance for events processed after a deep sleep wake (timer isn't exact)
 
-#define SR_SERIAL_INPUT 3
-#define SR_STORAGE_CLK 2
-#define SR_CLK 4 
-#define SR_OUTPUT_ENABLED 0 
-#define ENABLE_ICS_PIN 5
+#define AGENDA_SIZE (NUM_STATIONS * 2 + 8) // upcoming station events kept in memory and flash
+#define AGENDA_STATION_STARTS 8 // starts computed per station on each rebuild
+#define AGENDA_HORIZON (7 * 24 * 3600L) // one week
+#define RETAINED_DRAIN_MS 1000 // longest wait for the retained messages after connecting
+#define RETAINED_QUIET_MS 100 // without configured stations, the drain ends after this long without a new retained topic
 
 namespace sprinkler_controller {
 
@@ -31,8 +29,11 @@ struct Station {
   // config
   int id;
   int enable_pin;
-  char cron[40];
   long config_duration; // in seconds
+  uint16_t pulse_ms; // solenoid pulse width
+  cron_expr schedule; // compiled once when the config is received
+  bool has_schedule;
+  uint32_t config_fingerprint; // length and crc16 of the last applied config payload, 0 if none
 
   // state
   bool is_active;
@@ -46,6 +47,16 @@ struct Station {
 
 enum EventType { NOOP, START, STOP };
 
+/**
+ * An upcoming station event. The agenda keeps them sorted by time; a START
+ * uses the configured duration of its station.
+ **/
+struct AgendaEntry {
+  uint32_t time;
+  uint8_t id;
+  uint8_t type; // EventType
+};
+
 struct StationEvent {
   int8_t id = -1;
   time_t time = 0;
@@ -65,7 +76,7 @@ struct StationEvent {
 
 class StationController {
 public:
-  StationController() = default;
+  StationController();
 
   void init(NTPClient *time_client);
   StationEvent next_station_event();
@@ -79,25 +90,41 @@ public:
 private:
   NTPClient *m_time_client;
   bool m_enabled = true;
-  bool m_interface_mode;
-  Station m_stations[NUM_STATIONS] = {{1, STATION_1_EN_PIN, "", 0, false, 0, 0},
-                                      {2, STATION_2_EN_PIN, "", 0, false, 0, 0},
-                                      {3, STATION_3_EN_PIN, "", 0, false, 0, 0},
-                                      {4, STATION_4_EN_PIN, "", 0, false, 0, 0}};
-  StationEvent m_station_event;
+  bool m_interface_mode = false;
+  Station m_stations[NUM_STATIONS];
+  AgendaEntry m_agenda[AGENDA_SIZE];
+  uint8_t m_agenda_len = 0;
+  time_t m_agenda_consumed = 0; // time of the last event taken from the agenda
+  bool m_agenda_stale = false;
+  time_t m_next_deadline = 0; // time of the next station event or agenda refresh
+  bool m_schedule_changed = true;
+  bool m_save_pending = false;
+  time_t m_last_epoch = 0;
+  unsigned long m_last_epoch_millis = 0;
+  uint64_t m_retained_seen = 0; // RETAINED_ bits of the retained topics received since init()
 
   void mqtt_callback(char *topic, byte *payload, uint32_t length);
-  Station *get_station_from_topic(const char* topic);
+  Station *get_station(uint16_t station_id);
   bool can_start_station();
-  void process_topic_mode_set(const char* payload_str, uint16_t length);
+  void check_clock_jump(time_t now);
+  void invalidate_schedules();
+  void rebuild_agenda(time_t now);
+  void agenda_insert(const AgendaEntry &entry, time_t &dropped);
+  void agenda_pop();
+  void agenda_reschedule_stop(const Station &station);
+  StationEvent agenda_event(const AgendaEntry &entry);
+  void process_topic_mode_set(const char* payload_str, uint32_t length);
   void process_topic_mode_state(const char* payload_str, uint16_t length);
   void process_topic_station_set(Station &station, const char* payload_str, uint32_t length);
   void process_topic_station_state(Station &station);
   void process_topic_station_config(Station &station, const char* payload_str, uint32_t length);
   void process_topic_enabled_set(const char* payload_str, uint32_t length);
   void report_interface_mode_state();
+  uint64_t expected_retained();
+  void close_all_stations();
   void load();
   void save();
+  void commit();
   void print_state();
 };
 
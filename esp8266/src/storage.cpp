@@ -0,0 +1,160 @@
+/**
+ * Log-structured persistence on top of raw flash sectors.
+ *
+ * Every record is appended to the next free slot of the current sector and
+ * tagged with an increasing sequence number. The record with the highest
+ * sequence number is the current state. A sector is only erased once all its
+ * slots have been used, and writes with the same content as the current
+ * record are skipped altogether.
+ */
+#include "storage.h"
+#include "log.h"
+
+#if defined(ESP8266)
+extern "C" uint32_t _EEPROM_start;
+#define STORAGE_END_SECTOR ((((uint32_t)&_EEPROM_start - 0x40200000) / SPI_FLASH_SEC_SIZE) + 1)
+#else
+#define STORAGE_END_SECTOR STORAGE_SECTORS
+#endif
+
+namespace sprinkler_controller::storage {
+
+static const uint16_t RECORD_MAGIC = 0x5350;
+static const uint16_t EMPTY_MAGIC = 0xFFFF;
+
+struct RecordHeader {
+  uint16_t magic;
+  uint16_t size;
+  uint32_t seq;
+};
+
+static const uint32_t SLOT_SIZE = (sizeof(RecordHeader) + STORAGE_MAX_RECORD + 3) & ~3;
+static const uint32_t SLOTS_PER_SECTOR = SPI_FLASH_SEC_SIZE / SLOT_SIZE;
+static const uint32_t SLOT_COUNT = SLOTS_PER_SECTOR * STORAGE_SECTORS;
+
+// holds the current record: header followed by the payload
+static uint32_t s_record[SLOT_SIZE / 4];
+static RecordHeader &s_header = *reinterpret_cast<RecordHeader *>(s_record);
+static uint8_t *s_payload = reinterpret_cast<uint8_t *>(s_record) + sizeof(RecordHeader);
+
+static uint32_t s_next_slot = 0;
+static Stats s_stats = {0, 0, 0};
+
+static uint32_t slot_address(uint32_t slot) {
+  uint32_t sector = STORAGE_END_SECTOR - STORAGE_SECTORS + slot / SLOTS_PER_SECTOR;
+  return sector * SPI_FLASH_SEC_SIZE + (slot % SLOTS_PER_SECTOR) * SLOT_SIZE;
+}
+
+static bool is_blank(uint32_t address, uint32_t size) {
+  uint32_t chunk[16];
+
+  for (uint32_t offset = 0; offset < size; offset += sizeof(chunk)) {
+    uint32_t len = size - offset < sizeof(chunk) ? size - offset : sizeof(chunk);
+    if (!ESP.flashRead(address + offset, chunk, len)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < len / 4; i++) {
+      if (chunk[i] != 0xFFFFFFFF) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool begin() {
+  int32_t last_slot = -1;
+  RecordHeader header;
+
+  s_header.magic = EMPTY_MAGIC;
+  s_header.size = 0;
+  s_header.seq = 0;
+
+  for (uint32_t slot = 0; slot < SLOT_COUNT; slot++) {
+    if (!ESP.flashRead(slot_address(slot), reinterpret_cast<uint32_t *>(&header), sizeof(header))) {
+      return false;
+    }
+    // the sequence numbers in the ring are never more than SLOT_COUNT apart, so the newest
+    // record is still found after they wrap around
+    if (header.magic == RECORD_MAGIC && header.size <= STORAGE_MAX_RECORD && (last_slot == -1 || (int32_t)(header.seq - s_header.seq) > 0)) {
+      s_header = header;
+      last_slot = slot;
+    }
+  }
+
+  if (last_slot == -1) {
+    s_next_slot = 0;
+    return true;
+  }
+
+  s_next_slot = (last_slot + 1) % SLOT_COUNT;
+
+  debug_printf("Storage: record %u found in slot %d.\n", s_header.seq, last_slot);
+
+  return ESP.flashRead(slot_address(last_slot), s_record, SLOT_SIZE);
+}
+
+size_t read(void *data, size_t size) {
+  if (s_header.magic != RECORD_MAGIC) {
+    return 0;
+  }
+
+  size_t length = s_header.size < size ? s_header.size : size;
+  memcpy(data, s_payload, length);
+  return length;
+}
+
+bool write(const void *data, size_t size) {
+  if (size > STORAGE_MAX_RECORD) {
+    debug_printf("Storage: record too large (%u bytes)!\n", size);
+    return false;
+  }
+
+  if (s_header.magic == RECORD_MAGIC && s_header.size == size && memcmp(s_payload, data, size) == 0) {
+    s_stats.skipped++;
+    return true;
+  }
+
+  uint32_t slot = s_next_slot;
+
+  // a partially written slot (e.g. power loss) can't be reused until its sector is erased
+  if (slot % SLOTS_PER_SECTOR != 0 && !is_blank(slot_address(slot), SLOT_SIZE)) {
+    slot = ((slot / SLOTS_PER_SECTOR + 1) * SLOTS_PER_SECTOR) % SLOT_COUNT;
+  }
+
+  if (slot % SLOTS_PER_SECTOR == 0 && !is_blank(slot_address(slot), SPI_FLASH_SEC_SIZE)) {
+    if (!ESP.flashEraseSector(slot_address(slot) / SPI_FLASH_SEC_SIZE)) {
+      return false;
+    }
+    s_stats.erases++;
+  }
+
+  s_header.magic = RECORD_MAGIC;
+  s_header.size = size;
+  s_header.seq++;
+  memset(s_payload, 0xFF, STORAGE_MAX_RECORD);
+  memcpy(s_payload, data, size);
+
+  // the payload goes first so that a record only becomes valid once the header is written
+  uint32_t address = slot_address(slot);
+  uint32_t payload_size = (size + 3) & ~3;
+  bool ok = ESP.flashWrite(address + sizeof(RecordHeader), s_record + sizeof(RecordHeader) / 4, payload_size) &&
+            ESP.flashWrite(address, s_record, sizeof(RecordHeader));
+
+  s_next_slot = (slot + 1) % SLOT_COUNT;
+  s_stats.writes++;
+
+  if (!ok) {
+    // never skip the next write when this one didn't make it to the flash
+    s_header.magic = EMPTY_MAGIC;
+  }
+
+  return ok;
+}
+
+const Stats &stats() {
+  return s_stats;
+}
+
+} // namespace sprinkler_controller::storage
@@ -0,0 +1,34 @@
+#pragma once
+#ifndef _STORAGE_H_
+#define _STORAGE_H_
+
+#include <Arduino.h>
+
+// Number of flash sectors used as a ring of records. The sectors end at the
+// EEPROM sector and grow down into the (unused) filesystem area.
+#define STORAGE_SECTORS 2
+
+// Largest record. The station state of builds with more than 4 stations needs more room.
+#ifndef STORAGE_MAX_RECORD
+#define STORAGE_MAX_RECORD 320
+#endif
+
+namespace sprinkler_controller::storage {
+
+/**
+ * Flash usage counters since boot
+ **/
+struct Stats {
+  uint32_t writes;
+  uint32_t skipped; // writes with identical content that never reached the flash
+  uint32_t erases;
+};
+
+bool begin();
+size_t read(void *data, size_t size);
+bool write(const void *data, size_t size);
+const Stats &stats();
+
+} // namespace sprinkler_controller::storage
+
+#endif
@@ -0,0 +1,142 @@
+#include "telemetry.h"
+#include "log.h"
+#include "mqttcli.h"
+#include "record.h"
+#include "rtcstate.h"
+
+namespace sprinkler_controller::telemetry {
+
+struct History {
+  uint8_t head;
+  uint8_t count;
+  uint16_t crc;
+  uint16_t fast_wakes; // wakes that went back to sleep without WiFi
+  uint16_t reserved;
+  uint32_t fast_us;    // total time of those wakes
+  Sample samples[TELEMETRY_SAMPLES];
+};
+
+static_assert(sizeof(History) % 4 == 0, "RTC memory is accessed in 4 byte blocks");
+static_assert(RTC_TELEMETRY_BLOCK * 4 + sizeof(History) <= RTC_WIFI_BLOCK * 4, "The telemetry overlaps the WiFi cache");
+
+static uint32_t s_marks[PHASE_COUNT];
+static uint8_t s_counters[COUNTER_COUNT];
+
+static uint16_t checksum(History &history) {
+  uint16_t crc = history.crc;
+  history.crc = 0;
+  uint16_t result = crc16(reinterpret_cast<const uint8_t *>(&history), sizeof(History));
+  history.crc = crc;
+  return result;
+}
+
+// RTC memory holds garbage after a power cycle
+static void load(History &history) {
+  if (!ESP.rtcUserMemoryRead(RTC_TELEMETRY_BLOCK, reinterpret_cast<uint32_t *>(&history), sizeof(History)) ||
+      history.crc != checksum(history) || history.head >= TELEMETRY_SAMPLES || history.count > TELEMETRY_SAMPLES) {
+    memset(&history, 0, sizeof(History));
+  }
+}
+
+static void store(History &history) {
+  history.crc = checksum(history);
+  ESP.rtcUserMemoryWrite(RTC_TELEMETRY_BLOCK, reinterpret_cast<uint32_t *>(&history), sizeof(History));
+}
+
+// Starts a wake, the time since reset is the BOOT phase
+void begin() {
+  memset(s_marks, 0, sizeof(s_marks));
+  memset(s_counters, 0, sizeof(s_counters));
+  mark(BOOT);
+}
+
+void mark(Phase phase) {
+  s_marks[phase] = micros();
+}
+
+void count(Counter counter, uint8_t n) {
+  s_counters[counter] = s_counters[counter] + n > 255 ? 255 : s_counters[counter] + n;
+}
+
+void save(time_t epoch) {
+  History history;
+  load(history);
+
+  if (history.count == TELEMETRY_SAMPLES) {
+    history.head = (history.head + 1) % TELEMETRY_SAMPLES;
+    history.count--;
+  }
+
+  Sample &s = history.samples[(history.head + history.count) % TELEMETRY_SAMPLES];
+  memset(&s, 0, sizeof(Sample));
+  s.epoch = (uint32_t)epoch;
+
+  // phases that were never marked are zero, their time goes to the next marked phase
+  uint32_t last = 0;
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    if (s_marks[i] != 0) {
+      uint32_t ms = (s_marks[i] - last) / 1000;
+      s.phase_ms[i] = ms > 0xffff ? 0xffff : ms;
+      last = s_marks[i];
+    }
+  }
+
+  memcpy(s.counters, s_counters, sizeof(s.counters));
+  uint32_t free_heap = ESP.getFreeHeap();
+  s.free_heap = free_heap > 0xffff ? 0xffff : free_heap;
+  s.heap_fragmentation = ESP.getHeapFragmentation();
+  history.count++;
+
+  store(history);
+}
+
+void save_fast_wake() {
+  History history;
+  load(history);
+
+  if (history.fast_wakes < 0xffff) {
+    history.fast_wakes++;
+    history.fast_us += micros();
+  }
+
+  store(history);
+}
+
+/**
+ * Publishes the saved wakes, one per line:
+ * epoch boot,wifi,ntp,mqtt,drain,events,sleep (ms) wifi polls,wifi scans,ntp retries,mqtt attempts free heap/fragmentation
+ * The first line counts the wakes that skipped WiFi and their average time in ms.
+ **/
+bool flush() {
+  History history;
+  load(history);
+
+  if ((history.count == 0 && history.fast_wakes == 0) || !mqttcli::connected()) {
+    return false;
+  }
+
+  char text[40 + TELEMETRY_SAMPLES * 96];
+  size_t length = snprintf(text, sizeof(text), "fast %u %u", history.fast_wakes,
+                           history.fast_wakes > 0 ? (unsigned)(history.fast_us / history.fast_wakes / 1000) : 0);
+
+  for (int i = 0; i < history.count; i++) {
+    const Sample &s = history.samples[(history.head + i) % TELEMETRY_SAMPLES];
+    length += snprintf(text + length, sizeof(text) - length, "\n%u %u,%u,%u,%u,%u,%u,%u %u,%u,%u,%u %u/%u", s.epoch,
+                       s.phase_ms[BOOT], s.phase_ms[WIFI], s.phase_ms[NTP], s.phase_ms[MQTT], s.phase_ms[DRAIN],
+                       s.phase_ms[EVENTS], s.phase_ms[SLEEP], s.counters[WIFI_POLLS], s.counters[WIFI_SCANS], s.counters[NTP_RETRIES],
+                       s.counters[MQTT_ATTEMPTS], s.free_heap, s.heap_fragmentation);
+  }
+
+  if (!mqttcli::publish(TELEMETRY_TOPIC, (const uint8_t *)text, length, false)) {
+    return false;
+  }
+
+  memset(&history, 0, sizeof(History));
+  store(history);
+
+  debug_printf("Telemetry: %s\n", text);
+
+  return true;
+}
+
+} // namespace sprinkler_controller::telemetry
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <Arduino.h>
+
+#define TELEMETRY_SAMPLES 3 // online wakes kept until the next flush, the oldest are dropped first
+#define TELEMETRY_TOPIC "lawn-irrigation/telemetry"
+
+/**
+ * Wake phase timings. Each phase ends with mark(), so its duration is the
+ * time since the previous marked phase. save() keeps the wake in RTC memory
+ * right before deep sleep, and flush() publishes the saved wakes from a
+ * later online wake.
+ **/
+namespace sprinkler_controller::telemetry {
+
+enum Phase : uint8_t {
+  BOOT,   // reset until setup()
+  WIFI,   // association and DHCP
+  NTP,    // clock sync, including retries
+  MQTT,   // broker connection and subscriptions
+  DRAIN,  // retained messages
+  EVENTS, // due station events
+  SLEEP,  // next event, valve pulses, log flush and disconnect
+  PHASE_COUNT
+};
+
+enum Counter : uint8_t {
+  WIFI_POLLS,    // WiFi status polls while connecting
+  WIFI_SCANS,    // connections that scanned for the access point instead of using the cached one
+  NTP_RETRIES,
+  MQTT_ATTEMPTS,
+  COUNTER_COUNT
+};
+
+struct Sample {
+  uint32_t epoch;
+  uint16_t phase_ms[PHASE_COUNT];
+  uint8_t counters[COUNTER_COUNT];
+  uint8_t heap_fragmentation; // percent
+  uint16_t free_heap;
+};
+
+void begin();
+void mark(Phase phase);
+void count(Counter counter, uint8_t n = 1);
+void save(time_t epoch);
+void save_fast_wake();
+bool flush();
+
+} // namespace sprinkler_controller::telemetry
+
+#endif
@@ -0,0 +1,111 @@
+/**
+ * Topic routing in a single pass over the topic.
+ *
+ * Every topic is TOPIC_ROOT followed by a device and an action segment. Each
+ * segment is looked up in a small table of names with their lengths, so only
+ * names of the right length are compared, and the pair of indexes selects the
+ * handler from the route table. Segments must match whole, so "settings" is
+ * not "set" and "station1/config/x" is not a station config.
+ */
+#include "topics.h"
+
+namespace sprinkler_controller::topics {
+
+struct Segment {
+  const char *name;
+  uint8_t length;
+  bool numbered; // followed by a station number
+};
+
+#define SEGMENT(name, numbered) {name, sizeof(name) - 1, numbered}
+
+static const Segment DEVICES[] = {
+  SEGMENT("interface-mode", false),
+  SEGMENT("enabled", false),
+  SEGMENT("station", true),
+};
+
+static const Segment ACTIONS[] = {
+  SEGMENT("set", false),
+  SEGMENT("state", false),
+  SEGMENT("config", false),
+};
+
+static const uint8_t DEVICE_COUNT = sizeof(DEVICES) / sizeof(DEVICES[0]);
+static const uint8_t ACTION_COUNT = sizeof(ACTIONS) / sizeof(ACTIONS[0]);
+
+static const TopicId ROUTES[DEVICE_COUNT][ACTION_COUNT] = {
+  //               set                 state          config
+  /* interface */ {INTERFACE_MODE_SET, UNKNOWN,       UNKNOWN},
+  /* enabled */   {ENABLED_SET,        UNKNOWN,       UNKNOWN},
+  /* station */   {STATION_SET,        STATION_STATE, STATION_CONFIG},
+};
+
+static const size_t ROOT_LENGTH = sizeof(TOPIC_ROOT) - 1;
+
+// Returns the index of the segment or -1. 'number' receives the digits of a numbered segment.
+static int find_segment(const Segment *segments, uint8_t count, const char *str, size_t length, uint16_t &number) {
+  for (uint8_t i = 0; i < count; i++) {
+    const Segment &segment = segments[i];
+
+    if (!segment.numbered) {
+      if (length == segment.length && memcmp(str, segment.name, length) == 0) {
+        return i;
+      }
+      continue;
+    }
+
+    if (length <= segment.length || memcmp(str, segment.name, segment.length) != 0) {
+      continue;
+    }
+
+    uint32_t value = 0;
+    for (size_t k = segment.length; k < length; k++) {
+      if (str[k] < '0' || str[k] > '9' || value > 0xFFFF) {
+        return -1;
+      }
+      value = value * 10 + (str[k] - '0');
+    }
+    if (value > 0xFFFF) {
+      return -1;
+    }
+
+    number = value;
+    return i;
+  }
+
+  return -1;
+}
+
+Route match(const char *topic) {
+  Route route = {UNKNOWN, 0};
+
+  if (strncmp(topic, TOPIC_ROOT, ROOT_LENGTH) != 0) {
+    return route;
+  }
+
+  const char *device = topic + ROOT_LENGTH;
+  const char *action = strchr(device, '/');
+  if (action == NULL) {
+    return route;
+  }
+  action++;
+
+  uint16_t station = 0;
+  int device_index = find_segment(DEVICES, DEVICE_COUNT, device, action - device - 1, station);
+  if (device_index < 0) {
+    return route;
+  }
+
+  // the action is the last segment, a further '/' makes the length match nothing
+  int action_index = find_segment(ACTIONS, ACTION_COUNT, action, strlen(action), station);
+  if (action_index < 0) {
+    return route;
+  }
+
+  route.id = ROUTES[device_index][action_index];
+  route.station = route.id == UNKNOWN ? 0 : station;
+  return route;
+}
+
+} // namespace sprinkler_controller::topics
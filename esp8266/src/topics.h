@@ -0,0 +1,33 @@
+#pragma once
+#ifndef _TOPICS_H_
+#define _TOPICS_H_
+
+#include <Arduino.h>
+
+#define TOPIC_ROOT "lawn-irrigation/"
+
+namespace sprinkler_controller::topics {
+
+enum TopicId : uint8_t {
+  UNKNOWN,
+  INTERFACE_MODE_SET, // lawn-irrigation/interface-mode/set
+  ENABLED_SET,        // lawn-irrigation/enabled/set
+  STATION_SET,        // lawn-irrigation/station{x}/set
+  STATION_STATE,      // lawn-irrigation/station{x}/state
+  STATION_CONFIG      // lawn-irrigation/station{x}/config
+};
+
+/**
+ * The handler of an incoming topic and, for station topics, the station
+ * number written in it (any number of digits)
+ **/
+struct Route {
+  TopicId id;
+  uint16_t station;
+};
+
+Route match(const char *topic);
+
+} // namespace sprinkler_controller::topics
+
+#endif
@@ -0,0 +1,226 @@
+#include "valves.h"
+#include "log.h"
+
+namespace sprinkler_controller::valves {
+
+enum Phase { IDLE, SETTLE, PULSE };
+
+// Both outputs of a station, used to reject merges that would open and close a valve at once
+#define STATION_OUTPUT_PAIRS 0x5555555555555555ULL
+
+struct Transition {
+  Mask mask;
+  uint16_t enable_pins; // bit n pulses GPIO n
+  uint16_t pulse_ms;
+};
+
+static Transition s_queue[VALVE_QUEUE_SIZE];
+static uint8_t s_head = 0;
+static uint8_t s_count = 0;
+static Phase s_phase = IDLE;
+static unsigned long s_phase_started = 0;
+static Stats s_stats = {0, 0, 0};
+
+#ifdef VALVE_DIRECT_IO
+// Same bit order as the shiftOut() version, but every pin change is a single write to the
+// GPIO set/clear registers. HSPI is not an option: its pins are the station enable pins.
+static void set_shift_register(Mask value) {
+  const uint32_t data = 1 << SR_SERIAL_INPUT;
+  const uint32_t clock = 1 << SR_CLK;
+  const uint32_t latch = 1 << SR_STORAGE_CLK;
+
+  // the first byte shifted out ends up in the last register of the chain
+  for (int i = VALVE_SHIFT_REGISTERS - 1; i >= 0; i--) {
+    uint8_t bits = (uint8_t)(value >> (8 * i));
+    for (int b = 0; b < 8; b++, bits >>= 1) {
+      if (bits & 1) {
+        GPOS = data;
+      } else {
+        GPOC = data;
+      }
+      GPOS = clock;
+      GPOC = clock;
+    }
+  }
+
+  GPOC = latch;
+  GPOS = latch;
+  GPOC = latch;
+}
+#else
+static void set_shift_register(Mask value) {
+  // the first byte shifted out ends up in the last register of the chain
+  for (int i = VALVE_SHIFT_REGISTERS - 1; i >= 0; i--) {
+    shiftOut(SR_SERIAL_INPUT, SR_CLK, LSBFIRST, (uint8_t)(value >> (8 * i)));
+  }
+
+  digitalWrite(SR_STORAGE_CLK, LOW);
+  digitalWrite(SR_STORAGE_CLK, HIGH);
+  digitalWrite(SR_STORAGE_CLK, LOW);
+}
+#endif
+
+static void enable_ics() {
+  // TODO: check which pin we can use to control the ICS
+  //       https://randomnerdtutorials.com/esp8266-pinout-reference-gpios/
+
+  // setup
+  // use RX pin as GPIO
+  pinMode(SR_SERIAL_INPUT, FUNCTION_3);
+  pinMode(SR_SERIAL_INPUT, OUTPUT);
+
+  digitalWrite(STATION_1_EN_PIN, LOW);
+  pinMode(STATION_1_EN_PIN, OUTPUT);
+  digitalWrite(STATION_2_EN_PIN, LOW);
+  pinMode(STATION_2_EN_PIN, OUTPUT);
+  digitalWrite(STATION_3_EN_PIN, LOW);
+  pinMode(STATION_3_EN_PIN, OUTPUT);
+
+  digitalWrite(SR_OUTPUT_ENABLED, HIGH);
+  pinMode(SR_OUTPUT_ENABLED, OUTPUT);
+
+  digitalWrite(SR_CLK, LOW);
+  pinMode(SR_CLK, OUTPUT);
+
+  digitalWrite(SR_STORAGE_CLK, LOW);
+  pinMode(SR_STORAGE_CLK, OUTPUT);
+
+  // enable
+  digitalWrite(ENABLE_ICS_PIN, HIGH);
+}
+
+static void disable_ics() {
+  //disable
+  digitalWrite(ENABLE_ICS_PIN, LOW);
+
+  // revert from GPIO to RX 
+  pinMode(SR_SERIAL_INPUT, FUNCTION_0);
+  pinMode(SR_SERIAL_INPUT, INPUT);
+  
+  // float pins
+  pinMode(STATION_1_EN_PIN, INPUT);
+  pinMode(STATION_2_EN_PIN, INPUT);
+  pinMode(STATION_3_EN_PIN, INPUT);
+  pinMode(SR_OUTPUT_ENABLED, INPUT);
+  pinMode(SR_CLK, INPUT);
+  pinMode(SR_STORAGE_CLK, INPUT);
+}
+
+static void begin_transition(const Transition &t) {
+  enable_ics();
+
+  set_shift_register(t.mask);
+
+  digitalWrite(SR_OUTPUT_ENABLED, LOW);
+
+  s_phase = SETTLE;
+  s_phase_started = millis();
+
+  s_stats.pulses++;
+  s_stats.pulse_ms += t.pulse_ms;
+}
+
+static void write_enable_pins(uint16_t pins, uint8_t value) {
+  for (uint8_t pin = 0; pins != 0; pin++, pins >>= 1) {
+    if (pins & 1) {
+      digitalWrite(pin, value);
+    }
+  }
+}
+
+static void end_transition(const Transition &t) {
+  write_enable_pins(t.enable_pins, LOW);
+
+  digitalWrite(SR_OUTPUT_ENABLED, HIGH);
+
+  disable_ics();
+
+  s_phase = IDLE;
+}
+
+// Folds a transition into the last queued one so that both share a single latch and pulse.
+// The last transition must not have started, and the two must not drive the same station.
+static bool merge(Mask mask, uint8_t enable_pin, uint16_t pulse_ms) {
+  if (s_count == 0 || (s_count == 1 && s_phase != IDLE)) {
+    return false;
+  }
+
+  Transition &last = s_queue[(s_head + s_count - 1) % VALVE_QUEUE_SIZE];
+  Mask stations = (last.mask | (last.mask >> 1)) & STATION_OUTPUT_PAIRS;
+  if (stations & (mask | (mask >> 1))) {
+    return false;
+  }
+
+  last.mask |= mask;
+  last.enable_pins |= 1 << enable_pin;
+  if (pulse_ms > last.pulse_ms) {
+    last.pulse_ms = pulse_ms;
+  }
+  return true;
+}
+
+void request(Mask mask, uint8_t enable_pin, uint16_t pulse_ms) {
+  s_stats.requests++;
+
+  if (merge(mask, enable_pin, pulse_ms)) {
+    return;
+  }
+
+  // a dropped STOP would leave a valve open with nothing to close it
+  if (s_count == VALVE_QUEUE_SIZE) {
+    debug_printf("Valve queue is full. Waiting for a free slot...\n");
+    while (s_count == VALVE_QUEUE_SIZE) {
+      loop();
+      delay(1);
+    }
+  }
+
+  s_queue[(s_head + s_count) % VALVE_QUEUE_SIZE] = {mask, (uint16_t)(1 << enable_pin), pulse_ms};
+  s_count++;
+}
+
+void loop() {
+  if (s_count == 0) {
+    return;
+  }
+
+  const Transition &t = s_queue[s_head];
+  unsigned long elapsed = millis() - s_phase_started;
+
+  switch (s_phase) {
+    case IDLE:
+      begin_transition(t);
+      break;
+    case SETTLE:
+      if (elapsed >= VALVE_SETTLE_MS) {
+        write_enable_pins(t.enable_pins, HIGH);
+        s_phase = PULSE;
+        s_phase_started = millis();
+      }
+      break;
+    case PULSE:
+      if (elapsed >= t.pulse_ms) {
+        end_transition(t);
+        s_head = (s_head + 1) % VALVE_QUEUE_SIZE;
+        s_count--;
+      }
+      break;
+  }
+}
+
+bool busy() {
+  return s_count > 0;
+}
+
+void wait_idle() {
+  while (busy()) {
+    loop();
+    delay(1);
+  }
+}
+
+const Stats &stats() {
+  return s_stats;
+}
+
+} // namespace sprinkler_controller::valves
@@ -0,0 +1,67 @@
+#pragma once
+#ifndef _VALVES_H_
+#define _VALVES_H_
+
+#include <Arduino.h>
+
+// Stations wired to the chained 74HC595 shift registers, two outputs each.
+// Stations share the enable pins: station n pulses STATION_((n - 1) % 4 + 1)_EN_PIN.
+#ifndef NUM_STATIONS
+#define NUM_STATIONS 4
+#endif
+#define VALVE_SHIFT_REGISTERS ((NUM_STATIONS * 2 + 7) / 8)
+
+static_assert(NUM_STATIONS >= 1 && NUM_STATIONS <= 32, "NUM_STATIONS must be between 1 and 32");
+
+#define STATION_1_EN_PIN 14
+#define STATION_2_EN_PIN 12
+#define STATION_3_EN_PIN 13
+#define STATION_4_EN_PIN 15
+
+// Define VALVE_DIRECT_IO to load the shift registers through the GPIO set/clear registers
+// instead of shiftOut() and digitalWrite(). All SR_ pins must stay below GPIO16.
+#define SR_SERIAL_INPUT 3
+#define SR_STORAGE_CLK 2
+#define SR_CLK 4 
+#define SR_OUTPUT_ENABLED 0 
+#define ENABLE_ICS_PIN 5
+
+#define VALVE_SETTLE_MS 50 // time for the shift register outputs to settle before the pulse
+#define VALVE_PULSE_MS 1000 // default latching solenoid pulse width
+#define VALVE_MIN_PULSE_MS 20
+#define VALVE_MAX_PULSE_MS 5000
+#define VALVE_QUEUE_SIZE 8
+
+/**
+ * Non-blocking driver for the latching solenoids. Each transition loads the
+ * shift register and pulses the station enable pin. Transitions are queued
+ * and driven by loop(), so callers never wait for the pulse to complete.
+ * Transitions requested before the next loop() that touch different stations
+ * are latched together and share one pulse, the longest of them. A request is
+ * never dropped: with a full queue, request() first drives the oldest
+ * transition to completion. Callers must call wait_idle() before anything that
+ * may block, as an enable pin stays HIGH until loop() ends its pulse.
+ **/
+namespace sprinkler_controller::valves {
+
+// Shift register outputs, bit 2 * (n - 1) opens station n and the next bit closes it
+typedef uint64_t Mask;
+
+/**
+ * Valve usage counters since boot
+ **/
+struct Stats {
+  uint32_t requests;
+  uint32_t pulses;   // times the ICs were powered and the solenoids pulsed
+  uint32_t pulse_ms; // total pulse time
+};
+
+void request(Mask mask, uint8_t enable_pin, uint16_t pulse_ms);
+void loop();
+bool busy();
+void wait_idle();
+const Stats &stats();
+
+} // namespace sprinkler_controller::valves
+
+#endif